@@ -0,0 +1,98 @@
+// Counts the heap allocations made while the server handles keep-alive HTTP/1.1 requests:
+// global operator new is replaced by a counting one, and requests are sent from this process
+// with stack buffers only. Prints the allocations per request and fails above kMaxAllocations.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <string>
+#include <utility>
+
+#include "http_server.h"
+
+using namespace basic_http_server;
+
+namespace {
+    constexpr std::uint16_t kPort = 18185;
+    constexpr int kWarmUpRequests = 100;
+    constexpr int kRequests = 2000;
+    // currently 4: the content and the two header fields of the response, and the serialized response
+    constexpr double kMaxAllocations = 8;
+
+    std::atomic<std::uint64_t> allocations{0};
+
+    const char kRequest[] =
+        "GET /hello.html?lang=en HTTP/1.1\r\nHost: localhost:18185\r\nUser-Agent: allocation_count\r\n"
+        "Accept: text/html\r\nAccept-Language: en-US,en;q=0.5\r\nConnection: keep-alive\r\n\r\n";
+
+    // Send the request and read its response, which fits in one buffer
+    bool exchange(int fd) {
+        char buffer[4096];
+        if (send(fd, kRequest, sizeof(kRequest) - 1, MSG_NOSIGNAL) < 0) return false;
+        ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+        return count > 12 && std::strncmp(buffer, "HTTP/1.1 200", 12) == 0;
+    }
+}
+
+void* operator new(std::size_t size) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    if (void *p = std::malloc(size == 0 ? 1 : size)) return p;
+    throw std::bad_alloc();
+}
+
+// std::pmr::new_delete_resource allocates with the aligned overloads
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    allocations.fetch_add(1, std::memory_order_relaxed);
+    size_t align = static_cast<size_t>(alignment);
+    if (void *p = std::aligned_alloc(align, (size + align - 1) / align * align)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { std::free(p); }
+
+int main() {
+    HttpServer server("127.0.0.1", kPort);
+    server.RegisterHttpRequestHandler("/hello.html", HttpMethod::GET, [](const HttpRequest&) {
+        HttpResponse response(HttpStatusCode::Ok);
+        std::string content = "<!doctype html>\n<html>\n<body>\n<h1>Hello, world in an Html page</h1>\n</body>\n</html>\n";
+        response.SetHeader("Content-Type", "text/html");
+        response.SetContent(std::move(content));
+        return response;
+    });
+    server.Start();
+
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in address = {};
+    address.sin_family = AF_INET;
+    address.sin_port = htons(kPort);
+    address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (connect(fd, (const sockaddr *)&address, sizeof(address)) < 0) {
+        std::perror("connect");
+        return 1;
+    }
+    // the first requests fill the buffer pool and grow the per worker structures
+    for (int i = 0; i < kWarmUpRequests; i++) {
+        if (!exchange(fd)) return 1;
+    }
+
+    std::uint64_t before = allocations.load();
+    for (int i = 0; i < kRequests; i++) {
+        if (!exchange(fd)) return 1;
+    }
+    double per_request = static_cast<double>(allocations.load() - before) / kRequests;
+    std::printf("%.2f allocations per request\n", per_request);
+
+    close(fd);
+    server.Stop();
+    return per_request <= kMaxAllocations ? 0 : 1;
+}
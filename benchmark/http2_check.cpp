@@ -0,0 +1,410 @@
+// Checks the HTTP/2 support: the HPACK examples of RFC 7541 Appendix C, then requests to a local HttpServer
+// over a connection opened with prior knowledge and one upgraded from HTTP/1.1, flow control of a response
+// larger than the initial window, the rejection of a :path with control bytes and of a header block that
+// decodes to a huge header list. Prints every check and exits with the number of failed ones.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+
+#include "hpack.h"
+#include "http_server.h"
+
+using namespace basic_http_server;
+
+namespace {
+    constexpr std::uint16_t kPort = 18186;
+    constexpr size_t kBigContentLength = 200000;
+    constexpr std::uint8_t kFlagEndStream = 0x1;
+    constexpr std::uint8_t kFlagAck = 0x1;
+    constexpr std::uint8_t kFlagEndHeaders = 0x4;
+
+    int failures = 0;
+
+    void check(bool passed, const char *what) {
+        std::printf("%s %s\n", passed ? "ok    " : "FAILED", what);
+        if (!passed) failures++;
+    }
+
+    std::string from_hex(const std::string& hex) {
+        std::string bytes;
+        for (size_t i = 0; i + 1 < hex.length(); i += 2) {
+            bytes.push_back(static_cast<char>(std::strtoul(hex.substr(i, 2).c_str(), nullptr, 16)));
+        }
+        return bytes;
+    }
+
+    HeaderList decode(HpackDecoder *decoder, const std::string& hex) {
+        std::string block = from_hex(hex);
+        try {
+            return decoder->Decode(reinterpret_cast<const std::uint8_t *>(block.data()), block.length());
+        } catch (const std::exception&) {
+            return HeaderList();
+        }
+    }
+
+    std::string encode(HpackEncoder *encoder, const HeaderList& headers) {
+        std::string block;
+        encoder->Encode(headers, &block);
+        return block;
+    }
+
+    std::string big_content() {
+        std::string content(kBigContentLength, '\0');
+        for (size_t i = 0; i < content.length(); i++) content[i] = static_cast<char>('a' + i % 26);
+        return content;
+    }
+
+    // RFC 7541 Appendix C, hex strings are copied from the RFC without spaces
+    void check_hpack() {
+        HeaderList request1 = {{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+                               {":authority", "www.example.com"}};
+        HeaderList request2 = {{":method", "GET"}, {":scheme", "http"}, {":path", "/"},
+                               {":authority", "www.example.com"}, {"cache-control", "no-cache"}};
+        HeaderList request3 = {{":method", "GET"}, {":scheme", "https"}, {":path", "/index.html"},
+                               {":authority", "www.example.com"}, {"custom-key", "custom-value"}};
+
+        HpackDecoder plain_decoder;
+        bool decoded = decode(&plain_decoder, "828684410f7777772e6578616d706c652e636f6d") == request1;
+        decoded &= decode(&plain_decoder, "828684be58086e6f2d6361636865") == request2;
+        decoded &= decode(&plain_decoder, "828785bf400a637573746f6d2d6b65790c637573746f6d2d76616c7565") == request3;
+        check(decoded, "C.3 requests without Huffman coding are decoded");
+
+        HpackDecoder huffman_decoder;
+        decoded = decode(&huffman_decoder, "828684418cf1e3c2e5f23a6ba0ab90f4ff") == request1;
+        decoded &= decode(&huffman_decoder, "828684be5886a8eb10649cbf") == request2;
+        decoded &= decode(&huffman_decoder, "828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf") == request3;
+        check(decoded, "C.4 requests with Huffman coding are decoded");
+
+        HpackEncoder encoder;
+        bool encoded = encode(&encoder, request1) == from_hex("828684418cf1e3c2e5f23a6ba0ab90f4ff");
+        encoded &= encode(&encoder, request2) == from_hex("828684be5886a8eb10649cbf");
+        encoded &= encode(&encoder, request3) == from_hex("828785bf408825a849e95ba97d7f8925a849e95bb8e8b4bf");
+        check(encoded, "C.4 requests are encoded byte for byte");
+
+        // 256 bytes of dynamic table: every response evicts the oldest entries
+        HpackDecoder response_decoder(256);
+        HeaderList response1 = {{":status", "302"}, {"cache-control", "private"},
+                                {"date", "Mon, 21 Oct 2013 20:13:21 GMT"}, {"location", "https://www.example.com"}};
+        HeaderList response2 = {{":status", "307"}, {"cache-control", "private"},
+                                {"date", "Mon, 21 Oct 2013 20:13:21 GMT"}, {"location", "https://www.example.com"}};
+        HeaderList response3 = {{":status", "200"}, {"cache-control", "private"},
+                                {"date", "Mon, 21 Oct 2013 20:13:22 GMT"}, {"location", "https://www.example.com"},
+                                {"content-encoding", "gzip"},
+                                {"set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1"}};
+        decoded = decode(&response_decoder, "488264025885aec3771a4b6196d07abe941054d444a8200595040b8166e082a62d1bff"
+                                            "6e919d29ad171863c78f0b97c8e9ae82ae43d3") == response1;
+        decoded &= decode(&response_decoder, "4883640effc1c0bf") == response2;
+        decoded &= decode(&response_decoder, "88c16196d07abe941054d444a8200595040b8166e084a62d1bffc05a839bd9ab77ad94"
+                                             "e7821dd7f2e6c7b335dfdfcd5b3960d5af27087f3672c1ab270fb5291f9587316065c0"
+                                             "03ed4ee5b1063d5007") == response3;
+        check(decoded, "C.6 responses with Huffman coding are decoded across evictions");
+
+        HpackTable table(256);
+        for (const auto& header : response1) table.Add(header.first, header.second);
+        check(table.size() == 222, "C.6.1 dynamic table holds 222 bytes");
+        table.Add(":status", "307");
+        check(table.size() == 222 && table.Get(62).second == "307" && table.Get(65).first == "cache-control",
+              "C.6.2 evicts the oldest entry");
+        table.Add("date", "Mon, 21 Oct 2013 20:13:22 GMT");
+        table.Add("content-encoding", "gzip");
+        table.Add("set-cookie", "foo=ASDJKHQKBZXOQWEOPIUAXQWEOIU; max-age=3600; version=1");
+        check(table.size() == 215 && table.Get(62).first == "set-cookie" && table.Get(64).first == "date",
+              "C.6.3 dynamic table holds 215 bytes");
+    }
+
+    struct Frame {
+        std::uint8_t type;
+        std::uint8_t flags;
+        std::uint32_t stream_id;
+        std::string payload;
+    };
+
+    std::string frame(Http2FrameType type, std::uint8_t flags, std::uint32_t stream_id, const std::string& payload) {
+        std::string result;
+        result.push_back(static_cast<char>(payload.length() >> 16));
+        result.push_back(static_cast<char>(payload.length() >> 8));
+        result.push_back(static_cast<char>(payload.length()));
+        result.push_back(static_cast<char>(type));
+        result.push_back(static_cast<char>(flags));
+        for (int shift = 24; shift >= 0; shift -= 8) result.push_back(static_cast<char>(stream_id >> shift));
+        return result + payload;
+    }
+
+    std::string window_update(std::uint32_t stream_id, std::uint32_t increment) {
+        std::string payload;
+        for (int shift = 24; shift >= 0; shift -= 8) payload.push_back(static_cast<char>(increment >> shift));
+        return frame(Http2FrameType::WINDOW_UPDATE, 0, stream_id, payload);
+    }
+
+    std::uint32_t read_uint32(const std::string& data, size_t pos) {
+        const auto *p = reinterpret_cast<const std::uint8_t *>(data.data() + pos);
+        return (static_cast<std::uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+    }
+
+    // A client connection, input holds the bytes received but not parsed yet
+    struct Connection {
+        int fd = -1;
+        std::string input;
+
+        ~Connection() {
+            if (fd >= 0) close(fd);
+        }
+
+        bool Open() {
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(kPort);
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            return connect(fd, (const sockaddr *)&address, sizeof(address)) == 0;
+        }
+
+        bool Send(const std::string& data) {
+            return send(fd, data.data(), data.length(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.length());
+        }
+
+        // Receive more bytes, false on timeout or closed connection
+        bool Receive(int timeout_ms) {
+            pollfd poll_fd = {fd, POLLIN, 0};
+            if (poll(&poll_fd, 1, timeout_ms) <= 0) return false;
+            char buffer[16384];
+            ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+            if (count <= 0) return false;
+            input.append(buffer, count);
+            return true;
+        }
+
+        bool ReadFrame(Frame *frame, int timeout_ms = 5000) {
+            while (input.length() < 9 || input.length() < 9 + (read_uint32(input, 0) >> 8)) {
+                if (!Receive(timeout_ms)) return false;
+            }
+            size_t length = read_uint32(input, 0) >> 8;
+            frame->type = static_cast<std::uint8_t>(input[3]);
+            frame->flags = static_cast<std::uint8_t>(input[4]);
+            frame->stream_id = read_uint32(input, 5) & 0x7fffffff;
+            frame->payload = input.substr(9, length);
+            input.erase(0, 9 + length);
+            return true;
+        }
+
+        // HTTP/1.1 response head of an upgrade, empty on timeout
+        std::string ReadHead() {
+            size_t end;
+            while ((end = input.find("\r\n\r\n")) == std::string::npos) {
+                if (!Receive(5000)) return std::string();
+            }
+            std::string head = input.substr(0, end + 4);
+            input.erase(0, end + 4);
+            return head;
+        }
+    };
+
+    struct Response {
+        std::string status;
+        std::string content;
+        bool complete = false;
+    };
+
+    // Read frames until count streams are complete, every header block is decoded to keep the HPACK table
+    // in sync and the client window is credited back as data arrives
+    std::map<std::uint32_t, Response> read_responses(Connection *connection, HpackDecoder *decoder, size_t count) {
+        std::map<std::uint32_t, Response> responses;
+        size_t complete = 0;
+        Frame frame;
+        while (complete < count && connection->ReadFrame(&frame)) {
+            auto type = static_cast<Http2FrameType>(frame.type);
+            if (type == Http2FrameType::GOAWAY || type == Http2FrameType::RST_STREAM) break;
+            if (type == Http2FrameType::SETTINGS && (frame.flags & kFlagAck) == 0) {
+                connection->Send(::frame(Http2FrameType::SETTINGS, kFlagAck, 0, ""));
+            }
+            if (frame.stream_id == 0) continue;
+
+            Response& response = responses[frame.stream_id];
+            if (type == Http2FrameType::HEADERS) {
+                HeaderList headers;
+                try {
+                    headers = decoder->Decode(reinterpret_cast<const std::uint8_t *>(frame.payload.data()),
+                                              frame.payload.length());
+                } catch (const std::exception&) {
+                    break;
+                }
+                for (const auto& header : headers) {
+                    if (header.first == ":status") response.status = header.second;
+                }
+            } else if (type == Http2FrameType::DATA) {
+                response.content += frame.payload;
+                if (!frame.payload.empty()) {
+                    connection->Send(window_update(0, frame.payload.length()) +
+                                     window_update(frame.stream_id, frame.payload.length()));
+                }
+            }
+            if (frame.flags & kFlagEndStream) {
+                response.complete = true;
+                complete++;
+            }
+        }
+        return responses;
+    }
+
+    std::string get_headers(std::uint32_t stream_id, const std::string& path, HpackEncoder *encoder) {
+        std::string block = encode(encoder, {{":method", "GET"}, {":scheme", "http"}, {":path", path},
+                                             {":authority", "localhost"}});
+        return frame(Http2FrameType::HEADERS, kFlagEndHeaders | kFlagEndStream, stream_id, block);
+    }
+
+    void check_prior_knowledge() {
+        Connection connection;
+        HpackEncoder encoder;
+        HpackDecoder decoder;
+        // both header blocks in one write, encoded in order since the second one refers to the first
+        std::string requests = kHttp2Preface + frame(Http2FrameType::SETTINGS, 0, 0, "");
+        requests += get_headers(1, "/hello", &encoder);
+        requests += get_headers(3, "/missing", &encoder);
+        bool sent = connection.Open() && connection.Send(requests);
+
+        Frame settings;
+        bool header_list_limit = false;
+        if (sent && connection.ReadFrame(&settings) && settings.type == static_cast<std::uint8_t>(Http2FrameType::SETTINGS)) {
+            for (size_t i = 0; i + 6 <= settings.payload.length(); i += 6) {
+                std::uint16_t id = (static_cast<std::uint8_t>(settings.payload[i]) << 8) |
+                    static_cast<std::uint8_t>(settings.payload[i + 1]);
+                header_list_limit |= id == 0x6 && read_uint32(settings.payload, i + 2) == Http2Connection::kMaxHeaderListSize;
+            }
+        }
+        check(header_list_limit, "server SETTINGS announce SETTINGS_MAX_HEADER_LIST_SIZE");
+
+        auto responses = read_responses(&connection, &decoder, 2);
+        const Response& hello = responses[1];
+        check(hello.complete && hello.status == "200" && hello.content == "hello over h2",
+              "prior knowledge connection gets the response of stream 1");
+        const Response& missing = responses[3];
+        check(missing.complete && missing.status == "404", "unknown path on stream 3 gets 404");
+    }
+
+    void check_upgrade() {
+        Connection connection;
+        HpackDecoder decoder;
+        // HTTP2-Settings is SETTINGS_MAX_CONCURRENT_STREAMS = 100, base64url encoded
+        bool sent = connection.Open() &&
+            connection.Send("GET /hello HTTP/1.1\r\nHost: localhost\r\nConnection: Upgrade, HTTP2-Settings\r\n"
+                            "Upgrade: h2c\r\nHTTP2-Settings: AAMAAABk\r\n\r\n");
+        std::string head = sent ? connection.ReadHead() : std::string();
+        check(head.compare(0, 12, "HTTP/1.1 101") == 0, "Upgrade: h2c request gets 101 Switching Protocols");
+
+        connection.Send(kHttp2Preface + frame(Http2FrameType::SETTINGS, 0, 0, ""));
+        Response hello = read_responses(&connection, &decoder, 1)[1];
+        check(hello.complete && hello.status == "200" && hello.content == "hello over h2",
+              "upgrade request is answered on stream 1");
+
+        HpackEncoder encoder;
+        connection.Send(get_headers(3, "/hello", &encoder));
+        Response next = read_responses(&connection, &decoder, 1)[3];
+        check(next.complete && next.content == "hello over h2", "upgraded connection serves the next stream");
+    }
+
+    void check_invalid_path() {
+        Connection connection;
+        HpackEncoder encoder;
+        HpackDecoder decoder;
+        bool sent = connection.Open() &&
+            connection.Send(kHttp2Preface + frame(Http2FrameType::SETTINGS, 0, 0, "") +
+                            get_headers(1, "/hello\r\nx: forged", &encoder));
+        Response response = sent ? read_responses(&connection, &decoder, 1)[1] : Response();
+        check(response.complete && response.status == "400", ":path with control bytes gets 400");
+    }
+
+    void check_flow_control() {
+        Connection connection;
+        HpackEncoder encoder;
+        HpackDecoder decoder;
+        bool sent = connection.Open() &&
+            connection.Send(kHttp2Preface + frame(Http2FrameType::SETTINGS, 0, 0, "") + get_headers(1, "/big", &encoder));
+
+        // no WINDOW_UPDATE yet: the server must stop after the initial 65535 bytes of window
+        std::string content;
+        std::string status;
+        Frame frame;
+        while (sent && connection.ReadFrame(&frame, 500)) {
+            if (frame.type == static_cast<std::uint8_t>(Http2FrameType::DATA)) content += frame.payload;
+            if (frame.type == static_cast<std::uint8_t>(Http2FrameType::HEADERS)) {
+                for (const auto& header : decoder.Decode(reinterpret_cast<const std::uint8_t *>(frame.payload.data()),
+                                                         frame.payload.length())) {
+                    if (header.first == ":status") status = header.second;
+                }
+            }
+        }
+        check(status == "200" && content.length() == static_cast<size_t>(Http2Connection::kDefaultWindowSize),
+              "response stops at the initial flow control window");
+
+        std::uint32_t rest = kBigContentLength - content.length();
+        connection.Send(window_update(0, rest) + window_update(1, rest));
+        bool end_stream = false;
+        while (!end_stream && connection.ReadFrame(&frame)) {
+            if (frame.type != static_cast<std::uint8_t>(Http2FrameType::DATA)) continue;
+            content += frame.payload;
+            end_stream = (frame.flags & kFlagEndStream) != 0;
+        }
+        check(end_stream && content == big_content(), "WINDOW_UPDATE releases the rest of a 200 KB response");
+    }
+
+    void check_header_list_bomb() {
+        Connection connection;
+        // one 4 KB dynamic table entry referenced by 100 one-byte indexed fields: 400 KB of header list
+        std::string block;
+        block.push_back(0x40);
+        hpack_encode_string("x-bomb", &block);
+        hpack_encode_string(std::string(4000, 'a'), &block);
+        block += from_hex("828684");
+        block.push_back(0x01);      // :authority without indexing, the bomb stays at index 62
+        hpack_encode_string("localhost", &block);
+        block.append(100, static_cast<char>(0xbe));
+
+        bool sent = connection.Open() &&
+            connection.Send(kHttp2Preface + frame(Http2FrameType::SETTINGS, 0, 0, "") +
+                            frame(Http2FrameType::HEADERS, kFlagEndHeaders | kFlagEndStream, 1, block));
+        std::uint32_t error_code = 0;
+        Frame frame;
+        while (sent && connection.ReadFrame(&frame)) {
+            if (frame.type == static_cast<std::uint8_t>(Http2FrameType::GOAWAY) && frame.payload.length() >= 8) {
+                error_code = read_uint32(frame.payload, 4);
+                break;
+            }
+        }
+        check(error_code == static_cast<std::uint32_t>(Http2ErrorCode::ENHANCE_YOUR_CALM),
+              "header list bomb is answered with GOAWAY ENHANCE_YOUR_CALM");
+    }
+}
+
+int main() {
+    check_hpack();
+
+    HttpServer server("127.0.0.1", kPort);
+    server.RegisterHttpRequestHandler("/hello", HttpMethod::GET, [](const HttpRequest&) {
+        HttpResponse response;
+        response.SetContent("hello over h2");
+        return response;
+    });
+    server.RegisterHttpRequestHandler("/big", HttpMethod::GET, [](const HttpRequest&) {
+        HttpResponse response;
+        response.SetContent(big_content());
+        return response;
+    });
+    server.Start();
+
+    check_prior_knowledge();
+    check_upgrade();
+    check_invalid_path();
+    check_flow_control();
+    check_header_list_bomb();
+
+    server.Stop();
+    return failures;
+}
@@ -0,0 +1,130 @@
+// Measures the memory held by idle keep-alive connections: starts an HttpServer in this process, opens N
+// connections, sends one request on each and leaves them open, then reports how much VmRSS grew per connection.
+// The client ends only hold a file descriptor in user space, so the growth is the server's.
+//
+//   ./idle_connections [connections]
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http_server.h"
+
+using namespace basic_http_server;
+
+namespace {
+    constexpr std::uint16_t kPort = 18188;
+    constexpr long kDefaultConnections = 5000;
+    constexpr int kWarmUpRequests = 20;
+    constexpr rlim_t kSpareFileDescriptors = 100;
+
+    const char kRequest[] = "GET / HTTP/1.1\r\nHost: localhost\r\n\r\n";
+
+    long rss_kb() {
+        std::ifstream status("/proc/self/status");
+        std::string line;
+        while (std::getline(status, line)) {
+            if (line.compare(0, 6, "VmRSS:") == 0) return std::strtol(line.c_str() + 6, nullptr, 10);
+        }
+        return -1;
+    }
+
+    int connect_to(std::uint16_t port) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        timeval timeout = {5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (connect(fd, (const sockaddr *)&address, sizeof(address)) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    bool send_request(int fd) {
+        return send(fd, kRequest, sizeof(kRequest) - 1, MSG_NOSIGNAL) == sizeof(kRequest) - 1;
+    }
+
+    // The response fits in one buffer, only its status line is looked at
+    bool read_response(int fd) {
+        char buffer[4096];
+        ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+        return count > 9 && std::strncmp(buffer, "HTTP/1.1 ", 9) == 0;
+    }
+}
+
+int main(int argc, char **argv) {
+    long connections = argc > 1 ? std::strtol(argv[1], nullptr, 10) : kDefaultConnections;
+
+    // both ends of every connection are open in this process
+    rlimit limit = {};
+    getrlimit(RLIMIT_NOFILE, &limit);
+    rlim_t needed = 2 * connections + kSpareFileDescriptors;
+    if (limit.rlim_cur < needed) {
+        limit.rlim_cur = std::min(needed, limit.rlim_max);
+        setrlimit(RLIMIT_NOFILE, &limit);
+    }
+    if (limit.rlim_cur < needed) {
+        connections = (limit.rlim_cur - kSpareFileDescriptors) / 2;
+        std::printf("file descriptor limit %lu, measuring %ld connections\n",
+                    static_cast<unsigned long>(limit.rlim_cur), connections);
+    }
+
+    HttpServer server("127.0.0.1", kPort);
+    server.RegisterHttpRequestHandler("/", HttpMethod::GET, [](const HttpRequest&) {
+        HttpResponse response;
+        response.SetContent("idle");
+        return response;
+    });
+    server.Start();
+
+    // one round of requests first, so the per worker buffers and arenas are already counted
+    for (int i = 0; i < kWarmUpRequests; i++) {
+        int fd = connect_to(kPort);
+        if (fd < 0 || !send_request(fd) || !read_response(fd)) {
+            std::fprintf(stderr, "warm up request failed\n");
+            return 1;
+        }
+        close(fd);
+    }
+    std::vector<int> fds(connections, -1);     // filled now, its pages are not counted below
+    std::this_thread::sleep_for(std::chrono::seconds(1));
+    long before = rss_kb();
+
+    for (long i = 0; i < connections; i++) {
+        fds[i] = connect_to(kPort);
+        if (fds[i] < 0 || !send_request(fds[i])) {
+            std::perror("connect");
+            return 1;
+        }
+    }
+    for (int fd : fds) {
+        if (!read_response(fd)) {
+            std::fprintf(stderr, "unexpected response\n");
+            return 1;
+        }
+    }
+    std::this_thread::sleep_for(std::chrono::seconds(2));      // let the workers settle
+    long after = rss_kb();
+
+    std::printf("%ld idle connections: RSS %ld KB -> %ld KB, %.0f bytes per connection\n",
+                connections, before, after, (after - before) * 1024.0 / connections);
+    for (int fd : fds) close(fd);
+    server.Stop();
+    return 0;
+}
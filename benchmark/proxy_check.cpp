@@ -0,0 +1,178 @@
+// Runs the reverse proxy against a second local HttpServer: proxied GET, reuse of the pooled upstream
+// connection, prefix matching, per route rate limits, failover from a dead upstream, the timeout of
+// an upstream that never answers and the access log of it all. Prints every check and exits with the
+// number of failed ones.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+
+#include "http_server.h"
+
+using namespace basic_http_server;
+
+namespace {
+    constexpr std::uint16_t kProxyPort = 18180;
+    constexpr std::uint16_t kUpstreamPort = 18181;
+    constexpr std::uint16_t kDeadPort = 18182;      // nothing listens there
+    constexpr std::uint16_t kSilentPort = 18183;    // accepts connections, never answers
+    constexpr const char *kAccessLogPath = "proxy_check_access.log";
+
+    int failures = 0;
+
+    void check(bool passed, const char *what) {
+        std::printf("%s %s\n", passed ? "ok    " : "FAILED", what);
+        if (!passed) failures++;
+    }
+
+    int connect_to(std::uint16_t port) {
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_port = htons(port);
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        timeval timeout = {5, 0};
+        setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+        if (connect(fd, (const sockaddr *)&address, sizeof(address)) < 0) {
+            close(fd);
+            return -1;
+        }
+        return fd;
+    }
+
+    // Send a GET request and read one response delimited by Content-Length, empty on error
+    std::string get(int fd, const std::string& path) {
+        std::string request = "GET " + path + " HTTP/1.1\r\nHost: localhost\r\n\r\n";
+        if (send(fd, request.data(), request.length(), MSG_NOSIGNAL) < 0) return std::string();
+
+        std::string response;
+        char buffer[4096];
+        while (true) {
+            size_t header_end = response.find("\r\n\r\n");
+            if (header_end != std::string::npos) {
+                size_t length_pos = response.find("Content-Length: ");
+                size_t length = length_pos < header_end ? std::strtoul(response.c_str() + length_pos + 16, nullptr, 10) : 0;
+                if (response.length() >= header_end + 4 + length) return response;
+            }
+            ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+            if (count <= 0) return std::string();
+            response.append(buffer, count);
+        }
+    }
+
+    int status_of(const std::string& response) {
+        return response.length() > 12 ? std::atoi(response.c_str() + 9) : 0;
+    }
+
+    std::string body_of(const std::string& response) {
+        size_t header_end = response.find("\r\n\r\n");
+        return header_end == std::string::npos ? std::string() : response.substr(header_end + 4);
+    }
+
+    // Established connections to the local port, from /proc/net/tcp
+    int connections_to(std::uint16_t port) {
+        std::ifstream tcp("/proc/net/tcp");
+        std::string line;
+        std::getline(tcp, line);
+        int count = 0;
+        char remote[64], state[8];
+        while (std::getline(tcp, line)) {
+            if (std::sscanf(line.c_str(), "%*s %*s %63s %7s", remote, state) != 2) continue;
+            const char *colon = std::strchr(remote, ':');
+            if (colon != nullptr && std::strtoul(colon + 1, nullptr, 16) == port && std::string(state) == "01") count++;
+        }
+        return count;
+    }
+
+    // Access log lines with the status code
+    int logged(const std::string& log, int status_code) {
+        std::string status = "\" " + std::to_string(status_code) + " ";
+        int count = 0;
+        for (size_t pos = log.find(status); pos != std::string::npos; pos = log.find(status, pos + 1)) count++;
+        return count;
+    }
+
+    HttpResponse text(const std::string& content) {
+        HttpResponse response;
+        response.SetHeader("Content-Type", "text/plain");
+        response.SetContent(content);
+        return response;
+    }
+}
+
+int main() {
+    HttpServer upstream("127.0.0.1", kUpstreamPort);
+    upstream.RegisterHttpRequestHandler("/api/x", HttpMethod::GET, [](const HttpRequest&) { return text("upstream"); });
+    upstream.RegisterHttpRequestHandler("/api/limited", HttpMethod::GET, [](const HttpRequest&) { return text("upstream"); });
+    upstream.RegisterHttpRequestHandler("/failover/x", HttpMethod::GET, [](const HttpRequest&) { return text("upstream"); });
+    upstream.Start();
+
+    int silent_fd = socket(AF_INET, SOCK_STREAM, 0);
+    sockaddr_in silent_address = {};
+    silent_address.sin_family = AF_INET;
+    silent_address.sin_port = htons(kSilentPort);
+    silent_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (bind(silent_fd, (const sockaddr *)&silent_address, sizeof(silent_address)) < 0 || listen(silent_fd, 16) < 0) {
+        std::perror("silent upstream");
+        return 1;
+    }
+
+    HttpServer proxy("127.0.0.1", kProxyPort);
+    proxy.RegisterHttpRequestHandler("/apiary", HttpMethod::GET, [](const HttpRequest&) { return text("local"); });
+    proxy.RegisterProxyHandler("/api", {{"127.0.0.1", kUpstreamPort}});
+    proxy.RegisterProxyHandler("/failover", {{"127.0.0.1", kDeadPort}, {"127.0.0.1", kUpstreamPort}});
+    proxy.RegisterProxyHandler("/silent", {{"127.0.0.1", kSilentPort}});
+    proxy.SetProxyTimeout(std::chrono::milliseconds(500));
+    proxy.SetRateLimit("/api/limited", 0.01, 1);
+    std::remove(kAccessLogPath);
+    proxy.EnableAccessLog(kAccessLogPath);
+    proxy.Start();
+
+    int fd = connect_to(kProxyPort);
+    std::string response = get(fd, "/api/x");
+    check(status_of(response) == 200 && body_of(response) == "upstream", "GET is proxied to the upstream");
+
+    bool all_proxied = true;
+    for (int i = 0; i < 10; i++) all_proxied &= body_of(get(fd, "/api/x")) == "upstream";
+    check(all_proxied, "keep-alive client connection gets every response");
+    check(connections_to(kUpstreamPort) == 1, "one upstream connection is reused for all requests");
+    check(body_of(get(fd, "/apiary")) == "local", "/api does not match /apiary");
+    int first = status_of(get(fd, "/api/limited"));
+    check(first != 429 && status_of(get(fd, "/api/limited")) == 429, "per route rate limit applies to proxy routes");
+    close(fd);
+
+    bool all_failed_over = true;
+    for (int i = 0; i < 6; i++) {
+        int client_fd = connect_to(kProxyPort);
+        all_failed_over &= status_of(get(client_fd, "/failover/x")) == 200;
+        close(client_fd);
+    }
+    check(all_failed_over, "requests fail over from a dead upstream");
+
+    fd = connect_to(kProxyPort);
+    auto start = std::chrono::steady_clock::now();
+    response = get(fd, "/silent/x");
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    check(status_of(response) == 502 && elapsed < std::chrono::seconds(3), "silent upstream times out with 502");
+    close(fd);
+
+    proxy.Stop();       // flushes the access log
+    upstream.Stop();
+    close(silent_fd);
+
+    std::ifstream log_file(kAccessLogPath);
+    std::string log((std::istreambuf_iterator<char>(log_file)), std::istreambuf_iterator<char>());
+    check(logged(log, 200) == 19 && logged(log, 429) == 1 && logged(log, 502) == 1,
+          "proxied, rate limited and timed out requests are logged");
+    std::remove(kAccessLogPath);
+    return failures;
+}
@@ -0,0 +1,229 @@
+// Checks the WebSocket support: the accept key example of RFC 6455, websocket_mask against a byte by byte
+// reference, then a local HttpServer: opening handshake, echo, a broadcast to connections of two workers and
+// the disconnection of a client that never reads. Prints every check and exits with the number of failed ones.
+
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <cstdio>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "http_server.h"
+
+using namespace basic_http_server;
+
+namespace {
+    constexpr std::uint16_t kPort = 18187;
+    constexpr std::uint8_t kMaskingKey[4] = {0x37, 0xfa, 0x21, 0x3d};
+    constexpr size_t kFloodMessageSize = 8192;
+    constexpr int kFloodMessages = 2000;     // 16 MB, well past kMaxQueuedBytes and the socket buffers
+
+    int failures = 0;
+
+    void check(bool passed, const char *what) {
+        std::printf("%s %s\n", passed ? "ok    " : "FAILED", what);
+        if (!passed) failures++;
+    }
+
+    void check_mask() {
+        bool same = true;
+        char data[48], expected[48];
+        for (size_t length = 0; length <= 40; length++) {
+            for (size_t key_offset = 0; key_offset < 4; key_offset++) {
+                // data + 1 is not aligned, the block loops must not depend on it
+                for (size_t i = 0; i < length; i++) data[i + 1] = static_cast<char>(i * 7 + length);
+                for (size_t i = 0; i < length; i++) {
+                    expected[i] = static_cast<char>(data[i + 1] ^ kMaskingKey[(key_offset + i) & 3]);
+                }
+                data[length + 1] = 'x';
+                websocket_mask(data + 1, length, kMaskingKey, key_offset);
+                same &= std::string(data + 1, length) == std::string(expected, length) && data[length + 1] == 'x';
+            }
+        }
+        check(same, "websocket_mask matches the reference for lengths 0 to 40 at every key offset");
+    }
+
+    // A client connection, input holds the bytes received but not parsed yet
+    struct Client {
+        int fd = -1;
+        std::string input;
+
+        ~Client() {
+            if (fd >= 0) close(fd);
+        }
+
+        bool Open(int receive_buffer_size = 0) {
+            fd = socket(AF_INET, SOCK_STREAM, 0);
+            // set before connect, the window scale is negotiated with the SYN
+            if (receive_buffer_size > 0) {
+                setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &receive_buffer_size, sizeof(receive_buffer_size));
+            }
+            sockaddr_in address = {};
+            address.sin_family = AF_INET;
+            address.sin_port = htons(kPort);
+            address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+            return connect(fd, (const sockaddr *)&address, sizeof(address)) == 0;
+        }
+
+        bool Send(const std::string& data) {
+            return send(fd, data.data(), data.length(), MSG_NOSIGNAL) == static_cast<ssize_t>(data.length());
+        }
+
+        // Receive more bytes, false on timeout or closed connection
+        bool Receive(int timeout_ms = 5000) {
+            pollfd poll_fd = {fd, POLLIN, 0};
+            if (poll(&poll_fd, 1, timeout_ms) <= 0) return false;
+            char buffer[16384];
+            ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+            if (count <= 0) return false;
+            input.append(buffer, count);
+            return true;
+        }
+
+        // Opening handshake, return the response head
+        std::string Handshake(const std::string& path, const std::string& key) {
+            Send("GET " + path + " HTTP/1.1\r\nHost: localhost\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+                 "Sec-WebSocket-Key: " + key + "\r\nSec-WebSocket-Version: 13\r\n\r\n");
+            size_t end;
+            while ((end = input.find("\r\n\r\n")) == std::string::npos) {
+                if (!Receive()) return std::string();
+            }
+            std::string head = input.substr(0, end + 4);
+            input.erase(0, end + 4);
+            return head;
+        }
+
+        // Client to server frames are masked
+        bool SendText(const std::string& message) {
+            std::string frame;
+            frame.push_back(static_cast<char>(0x81));
+            if (message.length() < 126) {
+                frame.push_back(static_cast<char>(0x80 | message.length()));
+            } else {
+                frame.push_back(static_cast<char>(0x80 | 126));
+                frame.push_back(static_cast<char>(message.length() >> 8));
+                frame.push_back(static_cast<char>(message.length()));
+            }
+            frame.append(reinterpret_cast<const char *>(kMaskingKey), 4);
+            size_t payload = frame.length();
+            frame.append(message);
+            websocket_mask(&frame[payload], message.length(), kMaskingKey);
+            return Send(frame);
+        }
+
+        // Payload of the next unfragmented server frame, false on timeout or closed connection
+        bool ReadMessage(std::string *message) {
+            while (true) {
+                size_t header_length = 2, length = 0;
+                bool received = input.length() >= 2;
+                if (received) {
+                    length = input[1] & 0x7f;
+                    if (length == 126) {        // 16 bit extended payload length
+                        header_length = 4;
+                        received = input.length() >= 4;
+                        if (received) {
+                            length = (static_cast<std::uint8_t>(input[2]) << 8) | static_cast<std::uint8_t>(input[3]);
+                        }
+                    }
+                    received = received && input.length() >= header_length + length;
+                }
+                if (received) {
+                    message->assign(input, header_length, length);
+                    input.erase(0, header_length + length);
+                    return true;
+                }
+                if (!Receive()) return false;
+            }
+        }
+    };
+
+    // Read until the server closes the connection, return the number of bytes received or -1 on timeout
+    long drain(int fd) {
+        long total = 0;
+        char buffer[65536];
+        while (true) {
+            pollfd poll_fd = {fd, POLLIN, 0};
+            if (poll(&poll_fd, 1, 10000) <= 0) return -1;
+            ssize_t count = recv(fd, buffer, sizeof(buffer), 0);
+            if (count == 0 || (count < 0 && errno == ECONNRESET)) return total;
+            if (count < 0) return -1;
+            total += count;
+        }
+    }
+}
+
+int main() {
+    check(websocket_accept_key("dGhlIHNhbXBsZSBub25jZQ==") == "s3pPLMBiTxaQ9kYGzzhZRbK+xOo=",
+          "accept key of the RFC 6455 example");
+    check_mask();
+
+    std::mutex mutex;
+    std::vector<std::thread::id> open_threads;
+    WebSocketHandler handler;
+    handler.on_open = [&](WebSocketConnection&) {
+        std::lock_guard<std::mutex> lock(mutex);
+        open_threads.push_back(std::this_thread::get_id());
+    };
+    handler.on_message = [](WebSocketConnection& connection, const std::string& message, bool binary) {
+        connection.Send(message, binary);
+    };
+
+    HttpServer server("127.0.0.1", kPort);
+    server.RegisterWebSocketHandler("/ws", handler);
+    server.Start();
+
+    {
+        Client first, second;
+        std::string head = first.Open() ? first.Handshake("/ws", "dGhlIHNhbXBsZSBub25jZQ==") : std::string();
+        check(head.compare(0, 12, "HTTP/1.1 101") == 0 &&
+              head.find("Sec-WebSocket-Accept: s3pPLMBiTxaQ9kYGzzhZRbK+xOo=\r\n") != std::string::npos,
+              "handshake gets 101 with the accept key");
+
+        std::string message;
+        std::string long_message(1000, 'w');
+        check(first.SendText("hello") && first.ReadMessage(&message) && message == "hello", "short message is echoed");
+        check(first.SendText(long_message) && first.ReadMessage(&message) && message == long_message,
+              "1000 byte message is echoed");
+
+        // the listener hands connections to the workers in turn
+        head = second.Open() ? second.Handshake("/ws", "x3JJHMbDL1EzLkh9GBhXDw==") : std::string();
+        bool two_workers;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            two_workers = open_threads.size() == 2 && open_threads[0] != open_threads[1];
+        }
+        check(head.compare(0, 12, "HTTP/1.1 101") == 0 && two_workers, "second connection opens on another worker");
+
+        server.Broadcast("/ws", "news");
+        std::string first_message, second_message;
+        check(first.ReadMessage(&first_message) && first_message == "news" &&
+              second.ReadMessage(&second_message) && second_message == "news",
+              "broadcast reaches the connections of both workers");
+    }
+
+    Client slow;
+    slow.Open(4096);
+    check(slow.Handshake("/ws", "dGhlIHNhbXBsZSBub25jZQ==").compare(0, 12, "HTTP/1.1 101") == 0,
+          "client that never reads is connected");
+    std::string flood(kFloodMessageSize, 'f');
+    for (int i = 0; i < kFloodMessages; i++) server.Broadcast("/ws", flood);
+    long received = drain(slow.fd);
+    check(received >= 0 && received < static_cast<long>(kFloodMessageSize) * kFloodMessages,
+          "client that never reads is disconnected once its queue overflows");
+
+    Client next;
+    std::string message;
+    bool opened = next.Open() && next.Handshake("/ws", "dGhlIHNhbXBsZSBub25jZQ==").compare(0, 12, "HTTP/1.1 101") == 0;
+    check(opened && next.SendText("still there") && next.ReadMessage(&message) && message == "still there",
+          "server keeps serving new connections");
+
+    server.Stop();
+    return failures;
+}
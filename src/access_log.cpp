@@ -0,0 +1,148 @@
+#include "access_log.h"
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include <cerrno>
+#include <charconv>
+#include <chrono>
+#include <stdexcept>
+
+namespace basic_http_server {
+
+    namespace {
+        void append_number(std::string& out, std::uint64_t value) {
+            char digits[24];
+            auto end = std::to_chars(digits, digits + sizeof(digits), value).ptr;
+            out.append(digits, end);
+        }
+
+        // Control bytes, double quotes and backslashes become \xHH as in nginx, a target cannot forge log lines
+        void append_escaped(std::string& out, const char *data, size_t length) {
+            static constexpr char kHexDigits[] = "0123456789ABCDEF";
+            size_t start = 0;
+            for (size_t i = 0; i < length; i++) {
+                auto c = static_cast<std::uint8_t>(data[i]);
+                if (c >= 0x20 && c != 0x7f && c != '"' && c != '\\') continue;
+                out.append(data + start, i - start);
+                out.append("\\x");
+                out.push_back(kHexDigits[c >> 4]);
+                out.push_back(kHexDigits[c & 0xf]);
+                start = i + 1;
+            }
+            out.append(data + start, length - start);
+        }
+    }
+
+    AccessLog::AccessLog(const std::string &path, size_t ring_count) :
+        fd_(-1), ring_count_(ring_count), rings_(new AccessLogRing[ring_count]), running_(false),
+        cached_second_(-1), cached_time_(), cached_time_length_(0), reported_dropped_(0) {
+        if ((fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644)) < 0) {
+            throw std::runtime_error("Failed to open access log " + path);
+        }
+        batch_.reserve(kBatchSize + 1024);
+    }
+
+    AccessLog::~AccessLog() {
+        Stop();
+        close(fd_);
+    }
+
+    void AccessLog::Start() {
+        if (running_) return;
+        running_ = true;
+        thread_ = std::thread(&AccessLog::Run, this);
+    }
+
+    void AccessLog::Stop() {
+        if (!running_) return;
+        running_ = false;
+        thread_.join();
+        while (Drain() > 0) {}
+        Flush();
+    }
+
+    std::uint64_t AccessLog::dropped() const {
+        std::uint64_t dropped = 0;
+        for (size_t i = 0; i < ring_count_; i++) dropped += rings_[i].dropped();
+        return dropped;
+    }
+
+    void AccessLog::Run() {
+        while (running_) {
+            if (Drain() == 0) {
+                // nothing queued, write what is pending so the log is never far behind
+                Flush();
+                std::this_thread::sleep_for(std::chrono::milliseconds(kIdleSleepMs));
+            }
+        }
+    }
+
+    size_t AccessLog::Drain() {
+        AccessLogRecord records[64];
+        size_t total = 0;
+        for (size_t i = 0; i < ring_count_; i++) {
+            size_t count = rings_[i].Pop(records, 64);
+            for (size_t j = 0; j < count; j++) Format(records[j]);
+            total += count;
+        }
+
+        std::uint64_t dropped = this->dropped();
+        if (dropped != reported_dropped_) {
+            batch_.append("# access log full, ");
+            append_number(batch_, dropped - reported_dropped_);
+            batch_.append(" records dropped\n");
+            reported_dropped_ = dropped;
+        }
+        if (batch_.size() >= kBatchSize) Flush();
+        return total;
+    }
+
+    void AccessLog::Format(const AccessLogRecord &record) {
+        // 127.0.0.1 - - [18/Oct/2026:20:15:03 +0000] "GET /index.html HTTP/1.1" 200 105 312
+        const auto *address = reinterpret_cast<const std::uint8_t *>(&record.address);
+        for (int i = 0; i < 4; i++) {
+            append_number(batch_, address[i]);
+            batch_.push_back(i < 3 ? '.' : ' ');
+        }
+        batch_.append("- - ");
+
+        // strftime once per second rather than once per record
+        if (record.time != cached_second_) {
+            std::time_t time = record.time;
+            std::tm tm = {};
+            gmtime_r(&time, &tm);
+            cached_time_length_ = strftime(cached_time_, sizeof(cached_time_), "[%d/%b/%Y:%H:%M:%S +0000]", &tm);
+            cached_second_ = record.time;
+        }
+        batch_.append(cached_time_, cached_time_length_);
+
+        batch_.append(" \"");
+        batch_.append(to_string(static_cast<HttpMethod>(record.method)));
+        batch_.push_back(' ');
+        append_escaped(batch_, record.target, record.target_length);
+        batch_.push_back(' ');
+        batch_.append(to_string(static_cast<HttpVersion>(record.version)));
+        batch_.append("\" ");
+        append_number(batch_, record.status_code);
+        batch_.push_back(' ');
+        append_number(batch_, record.bytes);
+        batch_.push_back(' ');
+        append_number(batch_, record.latency_us);
+        batch_.push_back('\n');
+    }
+
+    void AccessLog::Flush() {
+        size_t written = 0;
+        while (written < batch_.size()) {
+            ssize_t count = write(fd_, batch_.data() + written, batch_.size() - written);
+            if (count < 0) {
+                if (errno == EINTR) continue;
+                break;                  // nothing sensible to do, the batch is lost
+            }
+            written += count;
+        }
+        batch_.clear();
+    }
+
+}
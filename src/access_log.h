@@ -0,0 +1,130 @@
+#ifndef BASIC_HTTP_SERVER_ACCESS_LOG_H
+#define BASIC_HTTP_SERVER_ACCESS_LOG_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "http_message.h"
+
+namespace basic_http_server {
+
+    // One access log entry, copied as is through the ring buffers
+    struct AccessLogRecord {
+        static constexpr size_t kMaxTargetLength = 99;   // longer targets are truncated
+
+        std::int64_t time;              // seconds since epoch
+        std::uint64_t bytes;            // response content size
+        std::uint32_t address;          // peer IPv4 address, network byte order
+        std::uint32_t latency_us;
+        std::uint16_t status_code;
+        std::uint8_t method;            // HttpMethod
+        std::uint8_t version;           // HttpVersion
+        std::uint8_t target_length;
+        char target[kMaxTargetLength];
+
+        void SetTarget(std::string_view value) {
+            target_length = static_cast<std::uint8_t>(std::min(value.length(), kMaxTargetLength));
+            memcpy(target, value.data(), target_length);
+        }
+    };
+    static_assert(sizeof(AccessLogRecord) == 128, "access log records should fill two cache lines");
+
+    /**
+     * Bounded single producer, single consumer queue of access log records.
+     * The worker thread pushes, the log thread pops; a full ring drops the record
+     * instead of blocking the worker.
+     */
+    class AccessLogRing {
+    public:
+        static constexpr size_t kCapacity = 2048;       // power of two
+
+        AccessLogRing() : head_(0), cached_tail_(0), dropped_(0), tail_(0) {}
+
+        bool TryPush(const AccessLogRecord& record) {
+            size_t head = head_.load(std::memory_order_relaxed);
+            if (head - cached_tail_ == kCapacity) {
+                cached_tail_ = tail_.load(std::memory_order_acquire);
+                if (head - cached_tail_ == kCapacity) {
+                    dropped_.store(dropped_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+                    return false;
+                }
+            }
+            slots_[head & (kCapacity - 1)] = record;
+            head_.store(head + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Move up to max_count records to records, return the number moved
+        size_t Pop(AccessLogRecord *records, size_t max_count) {
+            size_t tail = tail_.load(std::memory_order_relaxed);
+            size_t count = std::min(head_.load(std::memory_order_acquire) - tail, max_count);
+            for (size_t i = 0; i < count; i++) {
+                records[i] = slots_[(tail + i) & (kCapacity - 1)];
+            }
+            tail_.store(tail + count, std::memory_order_release);
+            return count;
+        }
+
+        std::uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+    private:
+        // producer and consumer indices live on separate cache lines
+        alignas(64) std::atomic<size_t> head_;
+        size_t cached_tail_;
+        std::atomic<std::uint64_t> dropped_;
+        alignas(64) std::atomic<size_t> tail_;
+        alignas(64) AccessLogRecord slots_[kCapacity];
+    };
+
+    /**
+     * Access log in the Common Log Format, followed by the latency in microseconds.
+     * Each worker pushes records into its own ring. A background thread formats them
+     * and appends them to the file in large batches.
+     */
+    class AccessLog {
+    public:
+        static constexpr size_t kBatchSize = 64 * 1024;       // bytes written at once
+        static constexpr int kIdleSleepMs = 10;
+
+        AccessLog(const std::string& path, size_t ring_count);
+        ~AccessLog();
+        AccessLog(const AccessLog&) = delete;
+        AccessLog& operator=(const AccessLog&) = delete;
+
+        void Start();
+        // Write the queued records and stop the log thread
+        void Stop();
+
+        // Called by the worker thread owning ring
+        bool Push(size_t ring, const AccessLogRecord& record) { return rings_[ring].TryPush(record); }
+        // Records dropped because a ring was full
+        std::uint64_t dropped() const;
+
+    private:
+        int fd_;
+        size_t ring_count_;
+        std::unique_ptr<AccessLogRing[]> rings_;
+        std::atomic<bool> running_;
+        std::thread thread_;
+        std::string batch_;
+        std::time_t cached_second_;
+        char cached_time_[32];           // "[18/Oct/2026:20:15:03 +0000]"
+        size_t cached_time_length_;
+        std::uint64_t reported_dropped_;
+
+        void Run();
+        size_t Drain();
+        void Format(const AccessLogRecord& record);
+        void Flush();
+    };
+
+}
+
+#endif //BASIC_HTTP_SERVER_ACCESS_LOG_H
@@ -0,0 +1,52 @@
+#ifndef BASIC_HTTP_SERVER_BUFFER_POOL_H
+#define BASIC_HTTP_SERVER_BUFFER_POOL_H
+
+#include <cstddef>
+#include <vector>
+
+namespace basic_http_server {
+
+    /**
+     * Fixed-size I/O buffers shared by the connections of one worker thread, not thread safe.
+     * A connection borrows a buffer while a read or write is in progress and gives it back once done,
+     * so idle connections hold no buffer. At most max_free returned buffers are kept for reuse.
+     */
+    class BufferPool {
+    public:
+        BufferPool(size_t buffer_size, size_t max_free) : buffer_size_(buffer_size), max_free_(max_free) {
+            free_.reserve(max_free);
+        }
+        ~BufferPool() {
+            for (char *buffer : free_) delete[] buffer;
+        }
+        BufferPool(const BufferPool&) = delete;
+        BufferPool& operator=(const BufferPool&) = delete;
+
+        char* Acquire() {
+            if (free_.empty()) return new char[buffer_size_];
+            char *buffer = free_.back();
+            free_.pop_back();
+            return buffer;
+        }
+
+        void Release(char *buffer) {
+            if (buffer == nullptr) return;
+            if (free_.size() < max_free_) {
+                free_.push_back(buffer);
+            } else {
+                delete[] buffer;
+            }
+        }
+
+        size_t buffer_size() const { return buffer_size_; }
+        size_t free_count() const { return free_.size(); }
+
+    private:
+        size_t buffer_size_;
+        size_t max_free_;
+        std::vector<char*> free_;
+    };
+
+}
+
+#endif //BASIC_HTTP_SERVER_BUFFER_POOL_H
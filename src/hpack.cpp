@@ -0,0 +1,386 @@
+#include "hpack.h"
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace basic_http_server {
+
+    namespace {
+        struct HuffmanSymbol {
+            std::uint32_t code;
+            int bits;
+        };
+
+        // Code of every byte value followed by the EOS symbol (256)
+        constexpr HuffmanSymbol kHuffmanCodes[257] = {
+            {0x1ff8, 13}, {0x7fffd8, 23}, {0xfffffe2, 28}, {0xfffffe3, 28},
+            {0xfffffe4, 28}, {0xfffffe5, 28}, {0xfffffe6, 28}, {0xfffffe7, 28},
+            {0xfffffe8, 28}, {0xffffea, 24}, {0x3ffffffc, 30}, {0xfffffe9, 28},
+            {0xfffffea, 28}, {0x3ffffffd, 30}, {0xfffffeb, 28}, {0xfffffec, 28},
+            {0xfffffed, 28}, {0xfffffee, 28}, {0xfffffef, 28}, {0xffffff0, 28},
+            {0xffffff1, 28}, {0xffffff2, 28}, {0x3ffffffe, 30}, {0xffffff3, 28},
+            {0xffffff4, 28}, {0xffffff5, 28}, {0xffffff6, 28}, {0xffffff7, 28},
+            {0xffffff8, 28}, {0xffffff9, 28}, {0xffffffa, 28}, {0xffffffb, 28},
+            {0x14, 6}, {0x3f8, 10}, {0x3f9, 10}, {0xffa, 12},
+            {0x1ff9, 13}, {0x15, 6}, {0xf8, 8}, {0x7fa, 11},
+            {0x3fa, 10}, {0x3fb, 10}, {0xf9, 8}, {0x7fb, 11},
+            {0xfa, 8}, {0x16, 6}, {0x17, 6}, {0x18, 6},
+            {0x0, 5}, {0x1, 5}, {0x2, 5}, {0x19, 6},
+            {0x1a, 6}, {0x1b, 6}, {0x1c, 6}, {0x1d, 6},
+            {0x1e, 6}, {0x1f, 6}, {0x5c, 7}, {0xfb, 8},
+            {0x7ffc, 15}, {0x20, 6}, {0xffb, 12}, {0x3fc, 10},
+            {0x1ffa, 13}, {0x21, 6}, {0x5d, 7}, {0x5e, 7},
+            {0x5f, 7}, {0x60, 7}, {0x61, 7}, {0x62, 7},
+            {0x63, 7}, {0x64, 7}, {0x65, 7}, {0x66, 7},
+            {0x67, 7}, {0x68, 7}, {0x69, 7}, {0x6a, 7},
+            {0x6b, 7}, {0x6c, 7}, {0x6d, 7}, {0x6e, 7},
+            {0x6f, 7}, {0x70, 7}, {0x71, 7}, {0x72, 7},
+            {0xfc, 8}, {0x73, 7}, {0xfd, 8}, {0x1ffb, 13},
+            {0x7fff0, 19}, {0x1ffc, 13}, {0x3ffc, 14}, {0x22, 6},
+            {0x7ffd, 15}, {0x3, 5}, {0x23, 6}, {0x4, 5},
+            {0x24, 6}, {0x5, 5}, {0x25, 6}, {0x26, 6},
+            {0x27, 6}, {0x6, 5}, {0x74, 7}, {0x75, 7},
+            {0x28, 6}, {0x29, 6}, {0x2a, 6}, {0x7, 5},
+            {0x2b, 6}, {0x76, 7}, {0x2c, 6}, {0x8, 5},
+            {0x9, 5}, {0x2d, 6}, {0x77, 7}, {0x78, 7},
+            {0x79, 7}, {0x7a, 7}, {0x7b, 7}, {0x7ffe, 15},
+            {0x7fc, 11}, {0x3ffd, 14}, {0x1ffd, 13}, {0xffffffc, 28},
+            {0xfffe6, 20}, {0x3fffd2, 22}, {0xfffe7, 20}, {0xfffe8, 20},
+            {0x3fffd3, 22}, {0x3fffd4, 22}, {0x3fffd5, 22}, {0x7fffd9, 23},
+            {0x3fffd6, 22}, {0x7fffda, 23}, {0x7fffdb, 23}, {0x7fffdc, 23},
+            {0x7fffdd, 23}, {0x7fffde, 23}, {0xffffeb, 24}, {0x7fffdf, 23},
+            {0xffffec, 24}, {0xffffed, 24}, {0x3fffd7, 22}, {0x7fffe0, 23},
+            {0xffffee, 24}, {0x7fffe1, 23}, {0x7fffe2, 23}, {0x7fffe3, 23},
+            {0x7fffe4, 23}, {0x1fffdc, 21}, {0x3fffd8, 22}, {0x7fffe5, 23},
+            {0x3fffd9, 22}, {0x7fffe6, 23}, {0x7fffe7, 23}, {0xffffef, 24},
+            {0x3fffda, 22}, {0x1fffdd, 21}, {0xfffe9, 20}, {0x3fffdb, 22},
+            {0x3fffdc, 22}, {0x7fffe8, 23}, {0x7fffe9, 23}, {0x1fffde, 21},
+            {0x7fffea, 23}, {0x3fffdd, 22}, {0x3fffde, 22}, {0xfffff0, 24},
+            {0x1fffdf, 21}, {0x3fffdf, 22}, {0x7fffeb, 23}, {0x7fffec, 23},
+            {0x1fffe0, 21}, {0x1fffe1, 21}, {0x3fffe0, 22}, {0x1fffe2, 21},
+            {0x7fffed, 23}, {0x3fffe1, 22}, {0x7fffee, 23}, {0x7fffef, 23},
+            {0xfffea, 20}, {0x3fffe2, 22}, {0x3fffe3, 22}, {0x3fffe4, 22},
+            {0x7ffff0, 23}, {0x3fffe5, 22}, {0x3fffe6, 22}, {0x7ffff1, 23},
+            {0x3ffffe0, 26}, {0x3ffffe1, 26}, {0xfffeb, 20}, {0x7fff1, 19},
+            {0x3fffe7, 22}, {0x7ffff2, 23}, {0x3fffe8, 22}, {0x1ffffec, 25},
+            {0x3ffffe2, 26}, {0x3ffffe3, 26}, {0x3ffffe4, 26}, {0x7ffffde, 27},
+            {0x7ffffdf, 27}, {0x3ffffe5, 26}, {0xfffff1, 24}, {0x1ffffed, 25},
+            {0x7fff2, 19}, {0x1fffe3, 21}, {0x3ffffe6, 26}, {0x7ffffe0, 27},
+            {0x7ffffe1, 27}, {0x3ffffe7, 26}, {0x7ffffe2, 27}, {0xfffff2, 24},
+            {0x1fffe4, 21}, {0x1fffe5, 21}, {0x3ffffe8, 26}, {0x3ffffe9, 26},
+            {0xffffffd, 28}, {0x7ffffe3, 27}, {0x7ffffe4, 27}, {0x7ffffe5, 27},
+            {0xfffec, 20}, {0xfffff3, 24}, {0xfffed, 20}, {0x1fffe6, 21},
+            {0x3fffe9, 22}, {0x1fffe7, 21}, {0x1fffe8, 21}, {0x7ffff3, 23},
+            {0x3fffea, 22}, {0x3fffeb, 22}, {0x1ffffee, 25}, {0x1ffffef, 25},
+            {0xfffff4, 24}, {0xfffff5, 24}, {0x3ffffea, 26}, {0x7ffff4, 23},
+            {0x3ffffeb, 26}, {0x7ffffe6, 27}, {0x3ffffec, 26}, {0x3ffffed, 26},
+            {0x7ffffe7, 27}, {0x7ffffe8, 27}, {0x7ffffe9, 27}, {0x7ffffea, 27},
+            {0x7ffffeb, 27}, {0xffffffe, 28}, {0x7ffffec, 27}, {0x7ffffed, 27},
+            {0x7ffffee, 27}, {0x7ffffef, 27}, {0x7fffff0, 27}, {0x3ffffee, 26},
+            {0x3fffffff, 30},
+        };
+
+        const HeaderField kStaticTable[HpackTable::kStaticTableSize] = {
+            {":authority", ""},
+            {":method", "GET"},
+            {":method", "POST"},
+            {":path", "/"},
+            {":path", "/index.html"},
+            {":scheme", "http"},
+            {":scheme", "https"},
+            {":status", "200"},
+            {":status", "204"},
+            {":status", "206"},
+            {":status", "304"},
+            {":status", "400"},
+            {":status", "404"},
+            {":status", "500"},
+            {"accept-charset", ""},
+            {"accept-encoding", "gzip, deflate"},
+            {"accept-language", ""},
+            {"accept-ranges", ""},
+            {"accept", ""},
+            {"access-control-allow-origin", ""},
+            {"age", ""},
+            {"allow", ""},
+            {"authorization", ""},
+            {"cache-control", ""},
+            {"content-disposition", ""},
+            {"content-encoding", ""},
+            {"content-language", ""},
+            {"content-length", ""},
+            {"content-location", ""},
+            {"content-range", ""},
+            {"content-type", ""},
+            {"cookie", ""},
+            {"date", ""},
+            {"etag", ""},
+            {"expect", ""},
+            {"expires", ""},
+            {"from", ""},
+            {"host", ""},
+            {"if-match", ""},
+            {"if-modified-since", ""},
+            {"if-none-match", ""},
+            {"if-range", ""},
+            {"if-unmodified-since", ""},
+            {"last-modified", ""},
+            {"link", ""},
+            {"location", ""},
+            {"max-forwards", ""},
+            {"proxy-authenticate", ""},
+            {"proxy-authorization", ""},
+            {"range", ""},
+            {"referer", ""},
+            {"refresh", ""},
+            {"retry-after", ""},
+            {"server", ""},
+            {"set-cookie", ""},
+            {"strict-transport-security", ""},
+            {"transfer-encoding", ""},
+            {"user-agent", ""},
+            {"vary", ""},
+            {"via", ""},
+            {"www-authenticate", ""},
+        };
+
+        // Binary tree used to decode Huffman codes one bit at a time
+        struct HuffmanTree {
+            struct Node {
+                std::int16_t children[2];
+                std::int16_t symbol;            // -1 for internal nodes
+            };
+            std::vector<Node> nodes;
+
+            HuffmanTree() {
+                nodes.push_back({{0, 0}, -1});
+                for (int symbol = 0; symbol < 257; symbol++) {
+                    size_t node = 0;
+                    for (int bit = kHuffmanCodes[symbol].bits - 1; bit >= 0; bit--) {
+                        int direction = (kHuffmanCodes[symbol].code >> bit) & 1;
+                        if (nodes[node].children[direction] == 0) {
+                            nodes[node].children[direction] = static_cast<std::int16_t>(nodes.size());
+                            nodes.push_back({{0, 0}, -1});
+                        }
+                        node = nodes[node].children[direction];
+                    }
+                    nodes[node].symbol = static_cast<std::int16_t>(symbol);
+                }
+            }
+        };
+
+        std::uint64_t decode_integer(const std::uint8_t *&pos, const std::uint8_t *end, int prefix_bits) {
+            if (pos == end) throw std::invalid_argument("Truncated HPACK integer");
+            std::uint64_t max_prefix = (1u << prefix_bits) - 1;
+            std::uint64_t value = *pos++ & max_prefix;
+            if (value < max_prefix) return value;
+
+            for (int shift = 0; ; shift += 7) {
+                if (pos == end || shift > 56) throw std::invalid_argument("Invalid HPACK integer");
+                std::uint8_t byte = *pos++;
+                value += static_cast<std::uint64_t>(byte & 0x7f) << shift;
+                if ((byte & 0x80) == 0) return value;
+            }
+        }
+
+        std::string decode_string(const std::uint8_t *&pos, const std::uint8_t *end) {
+            if (pos == end) throw std::invalid_argument("Truncated HPACK string");
+            bool huffman = (*pos & 0x80) != 0;
+            std::uint64_t length = decode_integer(pos, end, 7);
+            if (length > static_cast<std::uint64_t>(end - pos)) throw std::invalid_argument("Truncated HPACK string");
+            const std::uint8_t *begin = pos;
+            pos += length;
+            return huffman ? huffman_decode(begin, length) : std::string(begin, pos);
+        }
+
+        // Headers whose value changes with every response, indexing them would only churn the table
+        bool should_index(const std::string& name) {
+            return name != "content-length" && name != "date" && name != "etag" && name != "set-cookie";
+        }
+    }
+
+    std::string huffman_decode(const std::uint8_t *data, size_t length) {
+        static const HuffmanTree tree;
+        std::string result;
+        size_t node = 0;
+        int padding_bits = 0;       // bits read since the last complete symbol, must all be 1
+        bool padding_ones = true;
+
+        result.reserve(length * 8 / 5);
+        for (size_t i = 0; i < length; i++) {
+            for (int bit = 7; bit >= 0; bit--) {
+                int direction = (data[i] >> bit) & 1;
+                node = tree.nodes[node].children[direction];
+                padding_bits++;
+                padding_ones = padding_ones && direction == 1;
+                if (node == 0) throw std::invalid_argument("Invalid Huffman code");
+                if (tree.nodes[node].symbol >= 0) {
+                    if (tree.nodes[node].symbol == 256) throw std::invalid_argument("Huffman string contains EOS");
+                    result.push_back(static_cast<char>(tree.nodes[node].symbol));
+                    node = 0;
+                    padding_bits = 0;
+                    padding_ones = true;
+                }
+            }
+        }
+        if (padding_bits > 7 || !padding_ones) {
+            throw std::invalid_argument("Invalid Huffman padding");
+        }
+        return result;
+    }
+
+    void huffman_encode(const std::string& value, std::string *out) {
+        std::uint64_t bits = 0;
+        int bit_count = 0;
+        for (unsigned char c : value) {
+            bits = (bits << kHuffmanCodes[c].bits) | kHuffmanCodes[c].code;
+            bit_count += kHuffmanCodes[c].bits;
+            while (bit_count >= 8) {
+                bit_count -= 8;
+                out->push_back(static_cast<char>(bits >> bit_count));
+            }
+        }
+        if (bit_count > 0) {        // pad with the most significant bits of EOS
+            out->push_back(static_cast<char>((bits << (8 - bit_count)) | (0xff >> bit_count)));
+        }
+    }
+
+    size_t huffman_encoded_length(const std::string& value) {
+        size_t bits = 0;
+        for (unsigned char c : value) bits += kHuffmanCodes[c].bits;
+        return (bits + 7) / 8;
+    }
+
+    void hpack_encode_integer(std::uint64_t value, int prefix_bits, std::uint8_t first_byte, std::string *out) {
+        std::uint64_t max_prefix = (1u << prefix_bits) - 1;
+        if (value < max_prefix) {
+            out->push_back(static_cast<char>(first_byte | value));
+            return;
+        }
+        out->push_back(static_cast<char>(first_byte | max_prefix));
+        value -= max_prefix;
+        while (value >= 0x80) {
+            out->push_back(static_cast<char>((value & 0x7f) | 0x80));
+            value >>= 7;
+        }
+        out->push_back(static_cast<char>(value));
+    }
+
+    void hpack_encode_string(const std::string& value, std::string *out) {
+        size_t huffman_length = huffman_encoded_length(value);
+        if (huffman_length < value.length()) {
+            hpack_encode_integer(huffman_length, 7, 0x80, out);
+            huffman_encode(value, out);
+        } else {
+            hpack_encode_integer(value.length(), 7, 0, out);
+            out->append(value);
+        }
+    }
+
+    const HeaderField& HpackTable::Get(size_t index) const {
+        if (index == 0 || index > kStaticTableSize + entries_.size()) {
+            throw std::invalid_argument("Invalid HPACK index");
+        }
+        return index <= kStaticTableSize ? kStaticTable[index - 1] : entries_[index - kStaticTableSize - 1];
+    }
+
+    size_t HpackTable::Find(const std::string& name, const std::string& value, bool *exact) const {
+        size_t name_index = 0;
+        *exact = false;
+        for (size_t i = 0; i < kStaticTableSize + entries_.size(); i++) {
+            const HeaderField& field = i < kStaticTableSize ? kStaticTable[i] : entries_[i - kStaticTableSize];
+            if (field.first != name) continue;
+            if (field.second == value) {
+                *exact = true;
+                return i + 1;
+            }
+            if (name_index == 0) name_index = i + 1;
+        }
+        return name_index;
+    }
+
+    void HpackTable::Add(const std::string& name, const std::string& value) {
+        size_t entry_size = name.length() + value.length() + kEntryOverhead;
+        if (entry_size > max_size_) {   // an entry larger than the table empties it
+            Evict(0);
+            return;
+        }
+        Evict(max_size_ - entry_size);
+        entries_.emplace_front(name, value);
+        size_ += entry_size;
+    }
+
+    void HpackTable::SetMaxSize(size_t max_size) {
+        max_size_ = max_size;
+        Evict(max_size_);
+    }
+
+    void HpackTable::Evict(size_t max_size) {
+        while (size_ > max_size) {
+            size_ -= entries_.back().first.length() + entries_.back().second.length() + kEntryOverhead;
+            entries_.pop_back();
+        }
+    }
+
+    HeaderList HpackDecoder::Decode(const std::uint8_t *data, size_t length) {
+        const std::uint8_t *pos = data, *end = data + length;
+        HeaderList headers;
+        size_t list_size = 0;
+
+        while (pos < end) {
+            std::uint8_t byte = *pos;
+            if ((byte & 0xe0) == 0x20) {                // dynamic table size update
+                std::uint64_t max_size = decode_integer(pos, end, 5);
+                if (max_size > max_table_size_) throw std::invalid_argument("HPACK table size too large");
+                table_.SetMaxSize(max_size);
+                continue;
+            }
+            if (byte & 0x80) {                          // indexed header field
+                headers.push_back(table_.Get(decode_integer(pos, end, 7)));
+            } else {                                    // literal header field
+                bool indexing = (byte & 0xc0) == 0x40;
+                std::uint64_t index = decode_integer(pos, end, indexing ? 6 : 4);
+                std::string name = index != 0 ? table_.Get(index).first : decode_string(pos, end);
+                std::string value = decode_string(pos, end);
+                if (indexing) table_.Add(name, value);
+                headers.emplace_back(std::move(name), std::move(value));
+            }
+            // one byte of indexed field can expand to a whole table entry, stop before the list grows too large
+            // https://www.rfc-editor.org/rfc/rfc9113#section-6.5.2
+            list_size += headers.back().first.length() + headers.back().second.length() + HpackTable::kEntryOverhead;
+            if (list_size > max_header_list_size_) throw std::length_error("HPACK header list too large");
+        }
+        return headers;
+    }
+
+    void HpackEncoder::SetMaxTableSize(size_t max_size) {
+        // never use more than the default size, even if the peer allows it
+        max_size = std::min(max_size, HpackTable::kDefaultSize);
+        if (max_size != table_.max_size()) {
+            table_.SetMaxSize(max_size);
+            pending_size_update_ = true;
+        }
+    }
+
+    void HpackEncoder::Encode(const HeaderList& headers, std::string *out) {
+        if (pending_size_update_) {
+            hpack_encode_integer(table_.max_size(), 5, 0x20, out);
+            pending_size_update_ = false;
+        }
+
+        for (const auto& header : headers) {
+            bool exact;
+            size_t index = table_.Find(header.first, header.second, &exact);
+            if (exact) {                                // indexed header field
+                hpack_encode_integer(index, 7, 0x80, out);
+                continue;
+            }
+            bool indexing = should_index(header.first);
+            hpack_encode_integer(index, indexing ? 6 : 4, indexing ? 0x40 : 0, out);
+            if (index == 0) hpack_encode_string(header.first, out);
+            hpack_encode_string(header.second, out);
+            if (indexing) table_.Add(header.first, header.second);
+        }
+    }
+}
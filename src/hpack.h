@@ -0,0 +1,87 @@
+#ifndef BASIC_HTTP_SERVER_HPACK_H
+#define BASIC_HTTP_SERVER_HPACK_H
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace basic_http_server {
+
+    using HeaderField = std::pair<std::string, std::string>;
+    using HeaderList = std::vector<HeaderField>;
+
+    // Huffman coding of string literals https://www.rfc-editor.org/rfc/rfc7541#appendix-B
+    std::string huffman_decode(const std::uint8_t *data, size_t length);
+    void huffman_encode(const std::string& value, std::string *out);
+    size_t huffman_encoded_length(const std::string& value);
+
+    /**
+     * HPACK indexing table: the static table followed by a dynamic table
+     * https://www.rfc-editor.org/rfc/rfc7541#section-2.3
+     * Indexes are 1-based, newest dynamic entries come right after the static ones.
+     */
+    class HpackTable {
+    public:
+        static constexpr size_t kDefaultSize = 4096;
+        static constexpr size_t kEntryOverhead = 32;
+        static constexpr size_t kStaticTableSize = 61;
+
+        explicit HpackTable(size_t max_size = kDefaultSize) : size_(0), max_size_(max_size) {}
+
+        // Throws std::invalid_argument when index is out of range
+        const HeaderField& Get(size_t index) const;
+        // Return the index of name (and value, when *exact is set) or 0 when there is none
+        size_t Find(const std::string& name, const std::string& value, bool *exact) const;
+        void Add(const std::string& name, const std::string& value);
+        void SetMaxSize(size_t max_size);
+
+        size_t size() const { return size_; }
+        size_t max_size() const { return max_size_; }
+
+    private:
+        std::deque<HeaderField> entries_;
+        size_t size_;
+        size_t max_size_;
+
+        void Evict(size_t max_size);
+    };
+
+    // Decode header blocks of one connection
+    class HpackDecoder {
+    public:
+        explicit HpackDecoder(size_t max_table_size = HpackTable::kDefaultSize,
+                              size_t max_header_list_size = SIZE_MAX) :
+            table_(max_table_size), max_table_size_(max_table_size), max_header_list_size_(max_header_list_size) {}
+
+        // Decode a complete header block, throws std::invalid_argument on malformed input
+        // and std::length_error when the decoded header list is larger than max_header_list_size
+        HeaderList Decode(const std::uint8_t *data, size_t length);
+
+    private:
+        HpackTable table_;
+        size_t max_table_size_;         // limit announced to the peer with SETTINGS_HEADER_TABLE_SIZE
+        size_t max_header_list_size_;   // limit announced to the peer with SETTINGS_MAX_HEADER_LIST_SIZE
+    };
+
+    // Encode header blocks of one connection
+    class HpackEncoder {
+    public:
+        HpackEncoder() : table_(), pending_size_update_(false) {}
+
+        // Peer changed SETTINGS_HEADER_TABLE_SIZE, announced at the start of the next header block
+        void SetMaxTableSize(size_t max_size);
+        void Encode(const HeaderList& headers, std::string *out);
+
+    private:
+        HpackTable table_;
+        bool pending_size_update_;
+    };
+
+    // Primitive type representations https://www.rfc-editor.org/rfc/rfc7541#section-5
+    void hpack_encode_integer(std::uint64_t value, int prefix_bits, std::uint8_t first_byte, std::string *out);
+    void hpack_encode_string(const std::string& value, std::string *out);
+}
+
+#endif //BASIC_HTTP_SERVER_HPACK_H
@@ -0,0 +1,555 @@
+#include "http2.h"
+
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <string>
+#include <utility>
+
+namespace basic_http_server {
+
+    namespace {
+        constexpr std::uint8_t kFlagEndStream = 0x1;
+        constexpr std::uint8_t kFlagAck = 0x1;
+        constexpr std::uint8_t kFlagEndHeaders = 0x4;
+        constexpr std::uint8_t kFlagPadded = 0x8;
+        constexpr std::uint8_t kFlagPriority = 0x20;
+
+        constexpr std::uint16_t kSettingsHeaderTableSize = 0x1;
+        constexpr std::uint16_t kSettingsEnablePush = 0x2;
+        constexpr std::uint16_t kSettingsMaxConcurrentStreams = 0x3;
+        constexpr std::uint16_t kSettingsInitialWindowSize = 0x4;
+        constexpr std::uint16_t kSettingsMaxFrameSize = 0x5;
+        constexpr std::uint16_t kSettingsMaxHeaderListSize = 0x6;
+
+        std::uint32_t read_uint32(const std::uint8_t *data) {
+            return (static_cast<std::uint32_t>(data[0]) << 24) | (data[1] << 16) | (data[2] << 8) | data[3];
+        }
+
+        void write_uint32(std::uint32_t value, std::string *out) {
+            out->push_back(static_cast<char>(value >> 24));
+            out->push_back(static_cast<char>(value >> 16));
+            out->push_back(static_cast<char>(value >> 8));
+            out->push_back(static_cast<char>(value));
+        }
+
+        // HTTP2-Settings header value is base64url without padding
+        std::string base64url_decode(const std::string& value) {
+            std::string result;
+            std::uint32_t bits = 0;
+            int bit_count = 0;
+            for (char c : value) {
+                int digit;
+                if (c >= 'A' && c <= 'Z') digit = c - 'A';
+                else if (c >= 'a' && c <= 'z') digit = c - 'a' + 26;
+                else if (c >= '0' && c <= '9') digit = c - '0' + 52;
+                else if (c == '-' || c == '+') digit = 62;
+                else if (c == '_' || c == '/') digit = 63;
+                else if (c == '=') break;
+                else throw std::invalid_argument("Invalid base64url character");
+                bits = (bits << 6) | digit;
+                bit_count += 6;
+                if (bit_count >= 8) {
+                    bit_count -= 8;
+                    result.push_back(static_cast<char>(bits >> bit_count));
+                }
+            }
+            return result;
+        }
+    }
+
+    Http2Connection::Http2Connection(RequestHandler_t handler, RequestFilter_t http1_only) :
+        handler_(std::move(handler)), http1_only_(std::move(http1_only)),
+        decoder_(HpackTable::kDefaultSize, kMaxHeaderListSize), output_offset_(0), preface_received_(false), last_stream_id_(0),
+        continuation_stream_id_(0), header_block_end_stream_(false), send_window_(kDefaultWindowSize),
+        initial_window_size_(kDefaultWindowSize), max_frame_size_(kMaxFrameSize),
+        goaway_sent_(false), goaway_received_(false) {}
+
+    void Http2Connection::Start() {
+        WriteSettings();
+    }
+
+    void Http2Connection::Start(const HttpRequest &upgrade_request, const std::string &http2_settings) {
+        output_ = "HTTP/1.1 101 Switching Protocols\r\nConnection: Upgrade\r\nUpgrade: h2c\r\n\r\n";
+        WriteSettings();
+
+        std::string settings;
+        try {
+            settings = base64url_decode(http2_settings);
+        } catch (const std::invalid_argument&) {
+            WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+            return;
+        }
+        // the 101 response acknowledges these settings
+        if (!ApplySettings(reinterpret_cast<const std::uint8_t *>(settings.data()), settings.length())) return;
+
+        last_stream_id_ = 1;
+        Stream& stream = streams_[1];
+        stream.send_window = initial_window_size_;
+        stream.end_stream = true;
+        Respond(1, upgrade_request);
+    }
+
+    void Http2Connection::Feed(const char *data, size_t length) {
+        if (goaway_sent_) return;
+        input_.append(data, length);
+
+        size_t pos = 0;
+        if (!preface_received_) {
+            size_t count = std::min(input_.length(), kHttp2PrefaceLength);
+            if (input_.compare(0, count, kHttp2Preface, count) != 0) {
+                WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+                return;
+            }
+            if (count < kHttp2PrefaceLength) return;
+            preface_received_ = true;
+            pos = kHttp2PrefaceLength;
+        }
+
+        // frame layout https://www.rfc-editor.org/rfc/rfc9113#section-4.1
+        while (!goaway_sent_ && input_.length() - pos >= 9) {
+            const auto *header = reinterpret_cast<const std::uint8_t *>(input_.data() + pos);
+            size_t frame_length = (header[0] << 16) | (header[1] << 8) | header[2];
+            if (frame_length > kMaxFrameSize) {
+                WriteGoaway(Http2ErrorCode::FRAME_SIZE_ERROR);
+                break;
+            }
+            if (input_.length() - pos < 9 + frame_length) break;
+
+            pos += 9 + frame_length;
+            HandleFrame(static_cast<Http2FrameType>(header[3]), header[4], read_uint32(header + 5) & 0x7fffffff,
+                        header + 9, frame_length);
+        }
+        input_.erase(0, pos);
+        FlushStreams();
+    }
+
+    void Http2Connection::Consume(size_t length) {
+        output_offset_ += length;
+        if (output_offset_ >= output_.length()) {
+            output_.clear();
+            output_offset_ = 0;
+        }
+    }
+
+    void Http2Connection::HandleFrame(Http2FrameType type, std::uint8_t flags, std::uint32_t stream_id,
+                                      const std::uint8_t *payload, size_t length) {
+        // a header block must be followed by its CONTINUATION frames only
+        if (continuation_stream_id_ != 0 &&
+            (type != Http2FrameType::CONTINUATION || stream_id != continuation_stream_id_)) {
+            WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+            return;
+        }
+
+        switch (type) {
+            case Http2FrameType::DATA:
+                HandleData(flags, stream_id, payload, length);
+                break;
+            case Http2FrameType::HEADERS:
+                HandleHeaders(flags, stream_id, payload, length);
+                break;
+            case Http2FrameType::PRIORITY:       // prioritization is not supported, streams are served in turn
+                if (stream_id == 0) WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+                else if (length != 5) WriteRstStream(stream_id, Http2ErrorCode::FRAME_SIZE_ERROR);
+                break;
+            case Http2FrameType::RST_STREAM:
+                if (stream_id == 0) WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+                else if (length != 4) WriteGoaway(Http2ErrorCode::FRAME_SIZE_ERROR);
+                else streams_.erase(stream_id);
+                break;
+            case Http2FrameType::SETTINGS:
+                if (stream_id != 0) WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+                else HandleSettings(flags, payload, length);
+                break;
+            case Http2FrameType::PUSH_PROMISE:   // clients cannot push
+                WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+                break;
+            case Http2FrameType::PING:
+                if (stream_id != 0) {
+                    WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+                } else if (length != 8) {
+                    WriteGoaway(Http2ErrorCode::FRAME_SIZE_ERROR);
+                } else if ((flags & kFlagAck) == 0) {
+                    WriteFrameHeader(Http2FrameType::PING, kFlagAck, 0, 8);
+                    output_.append(reinterpret_cast<const char *>(payload), 8);
+                }
+                break;
+            case Http2FrameType::GOAWAY:
+                goaway_received_ = true;
+                break;
+            case Http2FrameType::WINDOW_UPDATE:
+                HandleWindowUpdate(stream_id, payload, length);
+                break;
+            case Http2FrameType::CONTINUATION:
+                if (continuation_stream_id_ == 0) {
+                    WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+                } else if (header_block_.length() + length > kMaxRequestSize) {
+                    WriteGoaway(Http2ErrorCode::ENHANCE_YOUR_CALM);
+                } else {
+                    header_block_.append(reinterpret_cast<const char *>(payload), length);
+                    if (flags & kFlagEndHeaders) HandleHeaderBlock(stream_id);
+                }
+                break;
+            default:                             // unknown frame types must be ignored
+                break;
+        }
+    }
+
+    void Http2Connection::HandleHeaders(std::uint8_t flags, std::uint32_t stream_id,
+                                        const std::uint8_t *payload, size_t length) {
+        if (stream_id == 0 || stream_id % 2 == 0) {     // client streams are odd
+            WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+            return;
+        }
+        if (flags & kFlagPadded) {
+            size_t padding = length > 0 ? payload[0] + 1 : length + 1;
+            if (padding > length) {
+                WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+                return;
+            }
+            payload++;
+            length -= padding;
+        }
+        if (flags & kFlagPriority) {
+            if (length < 5) {
+                WriteGoaway(Http2ErrorCode::FRAME_SIZE_ERROR);
+                return;
+            }
+            payload += 5;
+            length -= 5;
+        }
+
+        header_block_.assign(reinterpret_cast<const char *>(payload), length);
+        header_block_end_stream_ = (flags & kFlagEndStream) != 0;
+        if (flags & kFlagEndHeaders) {
+            HandleHeaderBlock(stream_id);
+        } else {
+            continuation_stream_id_ = stream_id;
+        }
+    }
+
+    void Http2Connection::HandleHeaderBlock(std::uint32_t stream_id) {
+        HeaderList headers;
+        continuation_stream_id_ = 0;
+        // decode even blocks of refused streams, the HPACK tables must stay in sync
+        try {
+            headers = decoder_.Decode(reinterpret_cast<const std::uint8_t *>(header_block_.data()),
+                                      header_block_.length());
+        } catch (const std::invalid_argument&) {
+            WriteGoaway(Http2ErrorCode::COMPRESSION_ERROR);
+            return;
+        } catch (const std::length_error&) {
+            // the rest of the block was not decoded, the HPACK tables are out of sync
+            WriteGoaway(Http2ErrorCode::ENHANCE_YOUR_CALM);
+            return;
+        }
+        header_block_.clear();
+
+        auto it = streams_.find(stream_id);
+        if (it == streams_.end()) {
+            if (stream_id <= last_stream_id_) {         // stream already closed
+                WriteGoaway(Http2ErrorCode::STREAM_CLOSED);
+                return;
+            }
+            last_stream_id_ = stream_id;
+            if (streams_.size() >= kMaxConcurrentStreams || goaway_received_) {
+                WriteRstStream(stream_id, Http2ErrorCode::REFUSED_STREAM);
+                return;
+            }
+            it = streams_.emplace(stream_id, Stream()).first;
+            it->second.send_window = initial_window_size_;
+            it->second.headers = std::move(headers);
+        } else if (it->second.end_stream) {
+            WriteRstStream(stream_id, Http2ErrorCode::STREAM_CLOSED);
+            return;
+        } else if (!header_block_end_stream_) {         // trailer fields must end the stream
+            WriteRstStream(stream_id, Http2ErrorCode::PROTOCOL_ERROR);
+            streams_.erase(it);
+            return;
+        }
+
+        if (header_block_end_stream_) {
+            it->second.end_stream = true;
+            Dispatch(stream_id);
+        }
+    }
+
+    void Http2Connection::HandleData(std::uint8_t flags, std::uint32_t stream_id,
+                                     const std::uint8_t *payload, size_t length) {
+        if (stream_id == 0) {
+            WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+            return;
+        }
+        // padding counts against flow control too, the whole frame is credited back at once
+        size_t frame_length = length;
+        if (frame_length > 0) WriteWindowUpdate(0, frame_length);
+        if (flags & kFlagPadded) {
+            size_t padding = length > 0 ? payload[0] + 1 : length + 1;
+            if (padding > length) {
+                WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+                return;
+            }
+            payload++;
+            length -= padding;
+        }
+
+        auto it = streams_.find(stream_id);
+        if (it == streams_.end() || it->second.end_stream) {
+            WriteRstStream(stream_id, Http2ErrorCode::STREAM_CLOSED);
+            return;
+        }
+        Stream& stream = it->second;
+        if (stream.content.length() + length > kMaxRequestSize) {
+            WriteRstStream(stream_id, Http2ErrorCode::ENHANCE_YOUR_CALM);
+            streams_.erase(it);
+            return;
+        }
+        stream.content.append(reinterpret_cast<const char *>(payload), length);
+
+        if (flags & kFlagEndStream) {
+            stream.end_stream = true;
+            Dispatch(stream_id);
+        } else if (frame_length > 0) {
+            WriteWindowUpdate(stream_id, frame_length);
+        }
+    }
+
+    void Http2Connection::HandleSettings(std::uint8_t flags, const std::uint8_t *payload, size_t length) {
+        if (flags & kFlagAck) {
+            if (length != 0) WriteGoaway(Http2ErrorCode::FRAME_SIZE_ERROR);
+            return;
+        }
+        if (ApplySettings(payload, length)) {
+            WriteFrameHeader(Http2FrameType::SETTINGS, kFlagAck, 0, 0);
+        }
+    }
+
+    bool Http2Connection::ApplySettings(const std::uint8_t *payload, size_t length) {
+        if (length % 6 != 0) {
+            WriteGoaway(Http2ErrorCode::FRAME_SIZE_ERROR);
+            return false;
+        }
+        for (size_t i = 0; i < length; i += 6) {
+            std::uint16_t id = (payload[i] << 8) | payload[i + 1];
+            std::uint32_t value = read_uint32(payload + i + 2);
+            switch (id) {
+                case kSettingsHeaderTableSize:
+                    encoder_.SetMaxTableSize(value);
+                    break;
+                case kSettingsEnablePush:
+                    if (value > 1) {
+                        WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+                        return false;
+                    }
+                    break;
+                case kSettingsInitialWindowSize:
+                    if (value > kMaxWindowSize) {
+                        WriteGoaway(Http2ErrorCode::FLOW_CONTROL_ERROR);
+                        return false;
+                    }
+                    // the change applies to the window of every open stream
+                    for (auto& p : streams_) p.second.send_window += value - initial_window_size_;
+                    initial_window_size_ = value;
+                    break;
+                case kSettingsMaxFrameSize:
+                    if (value < 16384 || value > 16777215) {
+                        WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+                        return false;
+                    }
+                    max_frame_size_ = value;
+                    break;
+                default:
+                    break;
+            }
+        }
+        return true;
+    }
+
+    void Http2Connection::HandleWindowUpdate(std::uint32_t stream_id, const std::uint8_t *payload, size_t length) {
+        if (length != 4) {
+            WriteGoaway(Http2ErrorCode::FRAME_SIZE_ERROR);
+            return;
+        }
+        std::uint32_t increment = read_uint32(payload) & 0x7fffffff;
+
+        if (stream_id == 0) {
+            if (increment == 0) {
+                WriteGoaway(Http2ErrorCode::PROTOCOL_ERROR);
+            } else if ((send_window_ += increment) > kMaxWindowSize) {
+                WriteGoaway(Http2ErrorCode::FLOW_CONTROL_ERROR);
+            }
+            return;
+        }
+
+        auto it = streams_.find(stream_id);
+        if (it == streams_.end()) return;               // recently closed stream
+        if (increment == 0 || (it->second.send_window += increment) > kMaxWindowSize) {
+            WriteRstStream(stream_id, increment == 0 ? Http2ErrorCode::PROTOCOL_ERROR
+                                                     : Http2ErrorCode::FLOW_CONTROL_ERROR);
+            streams_.erase(it);
+        }
+    }
+
+    void Http2Connection::Dispatch(std::uint32_t stream_id) {
+        Stream& stream = streams_[stream_id];
+        HttpRequest request;
+        std::string method, path, authority;
+
+        for (auto& header : stream.headers) {
+            if (header.first == ":method") {
+                method = std::move(header.second);
+            } else if (header.first == ":path") {
+                path = std::move(header.second);
+            } else if (header.first == ":authority") {
+                authority = std::move(header.second);
+            } else if (header.first.empty() || header.first[0] != ':') {
+                request.SetHeader(header.first, header.second);
+            }
+        }
+        if (!authority.empty()) request.SetHeader("host", authority);
+        request.SetUri(Uri(path));
+        request.SetVersion(HttpVersion::HTTP_2_0);
+        request.SetContent(std::move(stream.content));
+        stream.headers.clear();
+        stream.content.clear();
+
+        try {
+            if (method.empty() || path.empty()) {
+                throw std::invalid_argument("Missing request pseudo-header field");
+            }
+            // control bytes and spaces are not allowed in a request target https://www.rfc-editor.org/rfc/rfc9113#section-8.3.1
+            bool invalid_path = std::any_of(path.begin(), path.end(), [](char c) {
+                return static_cast<unsigned char>(c) <= 0x20 || c == 0x7f;
+            });
+            if (invalid_path) throw std::invalid_argument("Invalid character in :path");
+            HttpMethod http_method = string_to_method(method);
+            request.SetMethod(http_method);
+        } catch (const std::invalid_argument& e) {
+            HttpResponse response(HttpStatusCode::BadRequest);
+            response.SetContent(e.what());
+            SendResponse(stream_id, std::move(response), true);
+            return;
+        }
+        if (http1_only_ && http1_only_(request)) {
+            WriteRstStream(stream_id, Http2ErrorCode::HTTP_1_1_REQUIRED);
+            streams_.erase(stream_id);
+            return;
+        }
+        Respond(stream_id, request);
+    }
+
+    void Http2Connection::Respond(std::uint32_t stream_id, const HttpRequest &request) {
+        HttpResponse response;
+        try {
+            response = handler_(request);
+        } catch (const std::invalid_argument& e) {
+            response = HttpResponse(HttpStatusCode::BadRequest);
+            response.SetContent(e.what());
+        } catch (const std::exception& e) {
+            response = HttpResponse(HttpStatusCode::InternalServerError);
+            response.SetContent(e.what());
+        }
+        SendResponse(stream_id, std::move(response), request.method() != HttpMethod::HEAD);
+    }
+
+    void Http2Connection::SendResponse(std::uint32_t stream_id, HttpResponse response, bool send_content) {
+        HeaderList headers;
+        headers.emplace_back(":status", std::to_string(static_cast<int>(response.status_code())));
+        for (const auto& p : response.headers()) {
+            std::string name(p.first.data(), p.first.length());
+            std::transform(name.begin(), name.end(), name.begin(), [](char c) { return tolower(c); });
+            // connection specific header fields are not allowed in HTTP/2
+            if (name == "connection" || name == "keep-alive" || name == "transfer-encoding" || name == "upgrade") {
+                continue;
+            }
+            headers.emplace_back(std::move(name), p.second);
+        }
+        std::string header_block;
+        encoder_.Encode(headers, &header_block);
+
+        bool has_content = send_content && response.content_length() > 0;
+        size_t offset = 0;
+        do {
+            size_t length = std::min(header_block.length() - offset, max_frame_size_);
+            std::uint8_t flags = offset + length == header_block.length() ? kFlagEndHeaders : 0;
+            if (offset == 0 && !has_content) flags |= kFlagEndStream;
+            WriteFrameHeader(offset == 0 ? Http2FrameType::HEADERS : Http2FrameType::CONTINUATION,
+                             flags, stream_id, length);
+            output_.append(header_block, offset, length);
+            offset += length;
+        } while (offset < header_block.length());
+
+        if (has_content) {
+            Stream& stream = streams_[stream_id];
+            stream.response = response.TakeContent();
+            stream.response_offset = 0;
+        } else {
+            streams_.erase(stream_id);
+        }
+    }
+
+    void Http2Connection::FlushStreams() {
+        // one DATA frame per stream and round, so concurrent responses are interleaved
+        bool progress = true;
+        while (progress && send_window_ > 0 && !goaway_sent_) {
+            progress = false;
+            for (auto it = streams_.begin(); it != streams_.end() && send_window_ > 0;) {
+                Stream& stream = it->second;
+                size_t remaining = stream.response.length() - stream.response_offset;
+                if (remaining == 0 || stream.send_window <= 0) {
+                    ++it;
+                    continue;
+                }
+                size_t length = std::min({remaining, max_frame_size_, static_cast<size_t>(send_window_),
+                                          static_cast<size_t>(stream.send_window)});
+                bool last = length == remaining;
+                WriteFrameHeader(Http2FrameType::DATA, last ? kFlagEndStream : 0, it->first, length);
+                output_.append(stream.response, stream.response_offset, length);
+                stream.response_offset += length;
+                stream.send_window -= length;
+                send_window_ -= length;
+                progress = true;
+                it = last ? streams_.erase(it) : std::next(it);
+            }
+        }
+    }
+
+    void Http2Connection::WriteFrameHeader(Http2FrameType type, std::uint8_t flags, std::uint32_t stream_id,
+                                           size_t length) {
+        output_.push_back(static_cast<char>(length >> 16));
+        output_.push_back(static_cast<char>(length >> 8));
+        output_.push_back(static_cast<char>(length));
+        output_.push_back(static_cast<char>(type));
+        output_.push_back(static_cast<char>(flags));
+        write_uint32(stream_id, &output_);
+    }
+
+    void Http2Connection::WriteSettings() {
+        WriteFrameHeader(Http2FrameType::SETTINGS, 0, 0, 12);
+        output_.push_back(static_cast<char>(kSettingsMaxConcurrentStreams >> 8));
+        output_.push_back(static_cast<char>(kSettingsMaxConcurrentStreams));
+        write_uint32(kMaxConcurrentStreams, &output_);
+        output_.push_back(static_cast<char>(kSettingsMaxHeaderListSize >> 8));
+        output_.push_back(static_cast<char>(kSettingsMaxHeaderListSize));
+        write_uint32(kMaxHeaderListSize, &output_);
+    }
+
+    void Http2Connection::WriteWindowUpdate(std::uint32_t stream_id, std::uint32_t increment) {
+        WriteFrameHeader(Http2FrameType::WINDOW_UPDATE, 0, stream_id, 4);
+        write_uint32(increment, &output_);
+    }
+
+    void Http2Connection::WriteRstStream(std::uint32_t stream_id, Http2ErrorCode error_code) {
+        WriteFrameHeader(Http2FrameType::RST_STREAM, 0, stream_id, 4);
+        write_uint32(static_cast<std::uint32_t>(error_code), &output_);
+    }
+
+    void Http2Connection::WriteGoaway(Http2ErrorCode error_code) {
+        if (goaway_sent_) return;
+        WriteFrameHeader(Http2FrameType::GOAWAY, 0, 0, 8);
+        write_uint32(last_stream_id_, &output_);
+        write_uint32(static_cast<std::uint32_t>(error_code), &output_);
+        goaway_sent_ = true;
+    }
+
+}
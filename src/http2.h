@@ -0,0 +1,136 @@
+#ifndef BASIC_HTTP_SERVER_HTTP2_H
+#define BASIC_HTTP_SERVER_HTTP2_H
+
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <string>
+
+#include "hpack.h"
+#include "http_message.h"
+
+namespace basic_http_server {
+
+    // Connection preface sent by clients https://www.rfc-editor.org/rfc/rfc9113#section-3.4
+    constexpr char kHttp2Preface[] = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+    constexpr size_t kHttp2PrefaceLength = sizeof(kHttp2Preface) - 1;
+
+    enum class Http2FrameType : std::uint8_t {
+        DATA = 0x0,
+        HEADERS = 0x1,
+        PRIORITY = 0x2,
+        RST_STREAM = 0x3,
+        SETTINGS = 0x4,
+        PUSH_PROMISE = 0x5,
+        PING = 0x6,
+        GOAWAY = 0x7,
+        WINDOW_UPDATE = 0x8,
+        CONTINUATION = 0x9
+    };
+
+    enum class Http2ErrorCode : std::uint32_t {
+        NO_ERROR = 0x0,
+        PROTOCOL_ERROR = 0x1,
+        INTERNAL_ERROR = 0x2,
+        FLOW_CONTROL_ERROR = 0x3,
+        SETTINGS_TIMEOUT = 0x4,
+        STREAM_CLOSED = 0x5,
+        FRAME_SIZE_ERROR = 0x6,
+        REFUSED_STREAM = 0x7,
+        CANCEL = 0x8,
+        COMPRESSION_ERROR = 0x9,
+        CONNECT_ERROR = 0xa,
+        ENHANCE_YOUR_CALM = 0xb,
+        INADEQUATE_SECURITY = 0xc,
+        HTTP_1_1_REQUIRED = 0xd
+    };
+
+    /**
+     * Server side of a cleartext HTTP/2 connection (h2c) https://www.rfc-editor.org/rfc/rfc9113
+     * Bytes read from the socket are fed to the connection, which parses frames, dispatches
+     * every complete request to the handler and queues frames to write back to the socket.
+     * Streams are multiplexed: responses are interleaved within the flow control windows.
+     */
+    class Http2Connection {
+    public:
+        using RequestHandler_t = std::function<HttpResponse(const HttpRequest&)>;
+        using RequestFilter_t = std::function<bool(const HttpRequest&)>;
+
+        static constexpr size_t kMaxConcurrentStreams = 100;
+        static constexpr size_t kMaxFrameSize = 16384;          // largest frame we accept
+        static constexpr size_t kMaxRequestSize = 1 << 20;      // header block and body of one stream
+        static constexpr size_t kMaxHeaderListSize = 65536;     // decoded header fields of one stream
+        static constexpr std::int64_t kDefaultWindowSize = 65535;
+        static constexpr std::int64_t kMaxWindowSize = 0x7fffffff;
+
+        // Streams whose request matches http1_only are reset with HTTP_1_1_REQUIRED, clients retry them over HTTP/1.1
+        explicit Http2Connection(RequestHandler_t handler, RequestFilter_t http1_only = nullptr);
+
+        // Connection opened with prior knowledge: the client starts with the preface
+        void Start();
+        // Connection upgraded from HTTP/1.1, the upgrade request becomes stream 1
+        void Start(const HttpRequest& upgrade_request, const std::string& http2_settings);
+
+        void Feed(const char *data, size_t length);
+
+        // Bytes waiting to be written to the socket
+        const char* output() const { return output_.data() + output_offset_; }
+        size_t output_size() const { return output_.size() - output_offset_; }
+        void Consume(size_t length);
+
+        // No more frames will be exchanged, the socket can be closed once the output is written
+        bool closed() const { return goaway_sent_ || (goaway_received_ && streams_.empty()); }
+
+    private:
+        struct Stream {
+            Stream() : send_window(kDefaultWindowSize), end_stream(false), response_offset(0) {}
+            HeaderList headers;
+            std::string content;
+            std::int64_t send_window;
+            bool end_stream;            // request fully received
+            std::string response;       // response content waiting for flow control credit
+            size_t response_offset;
+        };
+
+        RequestHandler_t handler_;
+        RequestFilter_t http1_only_;
+        HpackDecoder decoder_;
+        HpackEncoder encoder_;
+        std::map<std::uint32_t, Stream> streams_;
+        std::string input_;
+        std::string output_;
+        size_t output_offset_;
+        bool preface_received_;
+        std::uint32_t last_stream_id_;
+        std::uint32_t continuation_stream_id_;  // stream of an unfinished header block, 0 if none
+        std::string header_block_;
+        bool header_block_end_stream_;
+        std::int64_t send_window_;
+        std::int64_t initial_window_size_;      // peer SETTINGS_INITIAL_WINDOW_SIZE
+        size_t max_frame_size_;                 // peer SETTINGS_MAX_FRAME_SIZE
+        bool goaway_sent_;
+        bool goaway_received_;
+
+        void HandleFrame(Http2FrameType type, std::uint8_t flags, std::uint32_t stream_id,
+                         const std::uint8_t *payload, size_t length);
+        void HandleHeaders(std::uint8_t flags, std::uint32_t stream_id, const std::uint8_t *payload, size_t length);
+        void HandleHeaderBlock(std::uint32_t stream_id);
+        void HandleData(std::uint8_t flags, std::uint32_t stream_id, const std::uint8_t *payload, size_t length);
+        void HandleSettings(std::uint8_t flags, const std::uint8_t *payload, size_t length);
+        bool ApplySettings(const std::uint8_t *payload, size_t length);
+        void HandleWindowUpdate(std::uint32_t stream_id, const std::uint8_t *payload, size_t length);
+        void Dispatch(std::uint32_t stream_id);
+        void Respond(std::uint32_t stream_id, const HttpRequest& request);
+        void SendResponse(std::uint32_t stream_id, HttpResponse response, bool send_content);
+        void FlushStreams();
+
+        void WriteFrameHeader(Http2FrameType type, std::uint8_t flags, std::uint32_t stream_id, size_t length);
+        void WriteSettings();
+        void WriteWindowUpdate(std::uint32_t stream_id, std::uint32_t increment);
+        void WriteRstStream(std::uint32_t stream_id, Http2ErrorCode error_code);
+        void WriteGoaway(Http2ErrorCode error_code);
+    };
+
+}
+
+#endif //BASIC_HTTP_SERVER_HTTP2_H
@@ -4,9 +4,11 @@
 
 #include "http_message.h"
 
+#include <algorithm>
+#include <cctype>
+#include <charconv>
 #include <stdexcept>
 #include <string>
-#include <sstream>
 #include <type_traits>
 #include <utility>
 
@@ -74,6 +76,10 @@ namespace basic_http_server {
                 return "Method Not Allowed";
             case HttpStatusCode::ImATeapot:
                 return "I'm a Teapot";
+            case HttpStatusCode::UpgradeRequired:
+                return "Upgrade Required";
+            case HttpStatusCode::TooManyRequests:
+                return "Too Many Requests";
             case HttpStatusCode::InternalServerError:
                 return "Internal Server Error";
             case HttpStatusCode::NotImplemented:
@@ -129,27 +135,53 @@ namespace basic_http_server {
         }
     }
 
-    std::string to_string(const HttpRequest &request) {
-        std::ostringstream oss;
+    namespace {
+        std::string_view trim(std::string_view s) {
+            while (!s.empty() && std::isspace(static_cast<unsigned char>(s.front()))) s.remove_prefix(1);
+            while (!s.empty() && std::isspace(static_cast<unsigned char>(s.back()))) s.remove_suffix(1);
+            return s;
+        }
+
+        // Next space separated token of s, removed from s
+        std::string_view next_token(std::string_view& s) {
+            s = trim(s);
+            std::string_view token = s.substr(0, s.find(' '));
+            s.remove_prefix(token.length());
+            return token;
+        }
+
+        void append_headers(std::string& result, const HttpHeaders_t& headers) {
+            for (const auto& p : headers) {
+                result.append(p.first).append(": ").append(p.second).append("\r\n");
+            }
+            result.append("\r\n");
+        }
 
-        oss << to_string(request.method()) << ' ';
-        oss << request.uri().path() << ' ';
-        oss << to_string(request.version()) << "\r\n";
-        for (const auto& p : request.headers())
-            oss << p.first << ": " << p.second << "\r\n";
-        oss << "\r\n";
-        oss << request.content();
+        size_t headers_length(const HttpHeaders_t& headers) {
+            size_t length = 2;
+            for (const auto& p : headers) length += p.first.length() + p.second.length() + 4;
+            return length;
+        }
+    }
 
-        return oss.str();
+    std::string to_string(const HttpRequest &request) {
+        std::string method = to_string(request.method()), version = to_string(request.version());
+        std::string_view target = request.uri().target();
+        std::string result;
+
+        // one allocation for the whole message
+        result.reserve(method.length() + target.length() + version.length() + 4 +
+                       headers_length(request.headers()) + request.content_length());
+        result.append(method).append(" ").append(target).append(" ").append(version).append("\r\n");
+        append_headers(result, request.headers());
+        result.append(request.content());
+
+        return result;
     }
 
-    HttpRequest string_to_request(const std::string &request_string) {
-        std::string start_line, header_lines, message_body;
-        std::istringstream iss;
-        HttpRequest request;
-        std::string line, method, path, version;  // used for first line
-        std::string key, value;                   // used for header fields
-        Uri uri;
+    HttpRequest string_to_request(std::string_view request_string, std::pmr::memory_resource *resource) {
+        std::string_view start_line, header_lines, message_body;
+        HttpRequest request(resource);
         size_t lpos = 0, rpos = 0;
 
         rpos = request_string.find("\r\n", lpos);
@@ -162,58 +194,51 @@ namespace basic_http_server {
         rpos = request_string.find("\r\n\r\n", lpos);
         if (rpos != std::string::npos) {          // has header
             header_lines = request_string.substr(lpos, rpos - lpos);
-            lpos = rpos + 4;
-            rpos = request_string.length();
-            if (lpos < rpos) {
-                message_body = request_string.substr(lpos, rpos - lpos);
-            }
+            message_body = request_string.substr(rpos + 4);
         }
 
-        iss.clear();                              // parse the start line
-        iss.str(start_line);
-        iss >> method >> path >> version;
-        if (!iss.good() && !iss.eof()) {
-            throw std::invalid_argument("Invalid start line format");
-        }
+        // parse the start line
+        std::string method(next_token(start_line));
+        std::string_view path = next_token(start_line);
+        std::string version(next_token(start_line));
 
         HttpMethod httpMethod = string_to_method(method);
         request.SetMethod(httpMethod);
-        request.SetUri(Uri(path));
+        request.SetUri(Uri(path, resource));
         if (string_to_version(version) != request.version()) {
             throw std::logic_error("HTTP version not supported");
         }
 
-        iss.clear();                              // parse header fields
-        iss.str(header_lines);
-        while (std::getline(iss, line)) {
-            std::istringstream header_stream(line);
-            std::getline(header_stream, key, ':');
-            std::getline(header_stream, value);
-
-            // remove whitespaces from the two strings
-            key.erase(std::remove_if(key.begin(), key.end(), [](char c) { return std::isspace(c); }), key.end());
-            value.erase(std::remove_if(value.begin(), value.end(), [](char c) { return std::isspace(c); }), value.end());
-            request.SetHeader(key, value);
+        // parse header fields, the views point into request_string until they are stored
+        while (!header_lines.empty()) {
+            std::string_view line = header_lines.substr(0, header_lines.find('\n'));
+            header_lines.remove_prefix(std::min(line.length() + 1, header_lines.length()));
+            size_t colon = line.find(':');
+            if (colon == std::string_view::npos) continue;
+            request.SetHeader(trim(line.substr(0, colon)), trim(line.substr(colon + 1)));
         }
 
-        request.SetContent(message_body);
+        request.SetContent(std::string(message_body));
 
         return request;
     }
 
     std::string to_string(const HttpResponse &response, bool send_content) {
-        std::ostringstream oss;
-
-        oss << to_string(response.version()) << ' ';
-        oss << static_cast<int>(response.status_code()) << ' ';
-        oss << to_string(response.status_code()) << "\r\n";
-        for (const auto& p : response.headers())
-            oss << p.first << ": " << p.second << "\r\n";
-        oss << "\r\n";
+        std::string version = to_string(response.version()), reason = to_string(response.status_code());
+        char status_code[8];
+        auto status_end = std::to_chars(status_code, status_code + sizeof(status_code),
+                                        static_cast<int>(response.status_code())).ptr;
+        std::string result;
+
+        // one allocation for the whole message
+        result.reserve(version.length() + 12 + reason.length() + headers_length(response.headers()) +
+                       (send_content ? response.content_length() : 0));
+        result.append(version).append(" ").append(status_code, status_end).append(" ").append(reason).append("\r\n");
+        append_headers(result, response.headers());
         if (send_content)
-            oss << response.content();
+            result.append(response.content());
 
-        return oss.str();
+        return result;
     }
 
     HttpResponse string_to_response(const std::string &response_string) {
@@ -5,9 +5,17 @@
 #ifndef BASIC_HTTP_SERVER_HTTP_MESSAGE_H
 #define BASIC_HTTP_SERVER_HTTP_MESSAGE_H
 
+#include <strings.h>
+
+#include <algorithm>
+#include <charconv>
+#include <functional>
+#include <map>
+#include <memory_resource>
 #include <string>
+#include <string_view>
 #include <utility>
-#include <map>
+
 #include "uri.h"
 
 namespace basic_http_server {
@@ -97,41 +105,80 @@ namespace basic_http_server {
     HttpMethod string_to_method(const std::string& method_string);
     HttpVersion string_to_version(const std::string& version_string);
 
+    // Header field names are case insensitive https://www.rfc-editor.org/rfc/rfc9110#section-5.1
+    struct HeaderNameLess {
+        using is_transparent = void;
+
+        bool operator()(std::string_view lhs, std::string_view rhs) const {
+            int result = strncasecmp(lhs.data(), rhs.data(), std::min(lhs.length(), rhs.length()));
+            return result != 0 ? result < 0 : lhs.length() < rhs.length();
+        }
+    };
+
+    // Header fields, looked up by name in any case with any string type without building a key
+    using HttpHeaders_t = std::pmr::map<std::pmr::string, std::pmr::string, HeaderNameLess>;
+
     // Defines the common interface of an HTTP request and HTTP response.
     // Interface contains HTTP version, collection of header fields, message content
+    // Header fields live in the default memory resource unless another one is given, see MessageArena.
+    // Messages are move-only: the content of a response is moved to the socket buffer, never copied.
     class HttpMessageInterface {
     public:
         HttpMessageInterface() : version_(HttpVersion::HTTP_1_1) {}
+        explicit HttpMessageInterface(std::pmr::memory_resource *resource) :
+            version_(HttpVersion::HTTP_1_1), headers_(resource) {}
         virtual ~HttpMessageInterface() = default;
-
-        void SetHeader(const std::string& key, const std::string& value) { headers_[key] = std::move(value); }
-        void RemoveHeader(const std::string& key) { headers_.erase(key); }
+        HttpMessageInterface(const HttpMessageInterface&) = delete;
+        HttpMessageInterface& operator=(const HttpMessageInterface&) = delete;
+        HttpMessageInterface(HttpMessageInterface&&) = default;
+        HttpMessageInterface& operator=(HttpMessageInterface&&) = default;
+
+        void SetVersion(HttpVersion version) { version_ = version; }
+        void SetHeader(std::string_view key, std::string_view value) {
+            auto it = headers_.find(key);
+            if (it != headers_.end()) {
+                it->second.assign(value.data(), value.length());
+            } else {
+                headers_.emplace(key, value);
+            }
+        }
+        void RemoveHeader(std::string_view key) {
+            auto it = headers_.find(key);
+            if (it != headers_.end()) headers_.erase(it);
+        }
         void ClearHeader() { headers_.clear(); }
-        void SetContent(const std::string& content) {
+        // Pass an rvalue to hand the body over without a copy
+        void SetContent(std::string content) {
             content_ = std::move(content);
             SetContentLength();
         }
-        void ClearContent(const std::string& content) {
+        void ClearContent() {
             content_.clear();
             SetContentLength();
         }
+        // Hand the body over without a copy, the Content-Length header is left as it was
+        std::string TakeContent() { return std::move(content_); }
 
         HttpVersion version () const { return version_; }
-        std::string header(const std::string& key) const {
-            if (headers_.count(key) > 0)
-                return headers_.at(key);
-            return std::string();
+        // Empty if the header field is not set
+        std::string_view header(std::string_view key) const {
+            auto it = headers_.find(key);
+            return it != headers_.end() ? std::string_view(it->second) : std::string_view();
         }
-        std::map<std::string, std::string> headers() const { return headers_; }
-        std::string content() const { return content_; }
+        const HttpHeaders_t& headers() const { return headers_; }
+        const std::string& content() const { return content_; }
         size_t content_length() const { return content_.length(); }
 
     protected:
         HttpVersion version_;
-        std::map<std::string, std::string> headers_;
+        HttpHeaders_t headers_;
         std::string content_;
 
-        void SetContentLength() { SetHeader("Content-Length", std::to_string(content_.length())); }
+        void SetContentLength() {
+            char length[24];
+            auto result = std::to_chars(length, length + sizeof(length), content_.length());
+            SetHeader("Content-Length", std::string_view(length, result.ptr - length));
+        }
     };
 
     // A Http request
@@ -139,16 +186,20 @@ namespace basic_http_server {
     class HttpRequest : public HttpMessageInterface {
     public:
         HttpRequest() : method_(HttpMethod::GET){}
+        explicit HttpRequest(std::pmr::memory_resource *resource) :
+            HttpMessageInterface(resource), method_(HttpMethod::GET), uri_(resource) {}
         ~HttpRequest() = default;
+        HttpRequest(HttpRequest&&) = default;
+        HttpRequest& operator=(HttpRequest&&) = default;
 
-        void SetMethod(HttpMethod& method) {method_ = method;}
-        void SetUri(const Uri& uri) {uri_ = std::move(uri);}
+        void SetMethod(HttpMethod method) {method_ = method;}
+        void SetUri(Uri uri) {uri_ = std::move(uri);}
 
         HttpMethod method() const {return method_;}
-        Uri uri() const {return  uri_;}
+        const Uri& uri() const {return uri_;}
 
         friend std::string to_string(const HttpRequest& request);
-        friend HttpRequest string_to_request(const std::string& request_string);
+        friend HttpRequest string_to_request(std::string_view request_string, std::pmr::memory_resource *resource);
     private:
         HttpMethod method_;
         Uri uri_;
@@ -161,6 +212,8 @@ namespace basic_http_server {
         HttpResponse() : status_code_(HttpStatusCode::Ok) {}
         HttpResponse(HttpStatusCode status_code) : status_code_(status_code) {}
         ~HttpResponse() = default;
+        HttpResponse(HttpResponse&&) = default;
+        HttpResponse& operator=(HttpResponse&&) = default;
 
         void SetStatusCode(HttpStatusCode status_code) { status_code_ = status_code; }
 
@@ -176,7 +229,9 @@ namespace basic_http_server {
     // Functions to convert HTTP message objects to string
     std::string to_string(const HttpRequest& request);
     std::string to_string(const HttpResponse& response, bool send_content);
-    HttpRequest string_to_request(const std::string& request_string);
+    // The request, its URI and header fields are allocated from resource
+    HttpRequest string_to_request(std::string_view request_string,
+                                  std::pmr::memory_resource *resource = std::pmr::get_default_resource());
     HttpResponse string_to_response(const std::string& response_string);
 }
 
@@ -0,0 +1,217 @@
+#include "http_proxy.h"
+
+#include <arpa/inet.h>
+#include <strings.h>
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+#include <stdexcept>
+#include <string>
+
+namespace basic_http_server {
+
+    Upstream::Upstream(const UpstreamAddress& address) :
+        host_(address.host), port_(address.port), address_(), active_(0), failures_(0), retry_at_(0) {
+        address_.sin_family = AF_INET;
+        address_.sin_port = htons(port_);
+        if (inet_pton(AF_INET, host_.c_str(), &(address_.sin_addr)) != 1) {
+            throw std::invalid_argument("Invalid upstream address " + host_);
+        }
+    }
+
+    void Upstream::ReportFailure(Clock::time_point now) {
+        if (++failures_ >= kMaxFailures) {
+            retry_at_ = (now + kRetryInterval).time_since_epoch().count();
+        }
+    }
+
+    bool Upstream::healthy(Clock::time_point now) const {
+        return failures_ < kMaxFailures || now.time_since_epoch().count() >= retry_at_;
+    }
+
+    ProxyRoute::ProxyRoute(const std::string& prefix, const std::vector<UpstreamAddress>& upstreams,
+                           LoadBalancing balancing) : prefix_(prefix), balancing_(balancing), next_(0) {
+        if (upstreams.empty()) {
+            throw std::invalid_argument("Proxy route needs at least one upstream");
+        }
+        for (const auto& address : upstreams) {
+            upstreams_.push_back(std::make_unique<Upstream>(address));
+        }
+    }
+
+    Upstream* ProxyRoute::Select() {
+        auto now = Upstream::Clock::now();
+        size_t count = upstreams_.size();
+        size_t start = next_.fetch_add(1, std::memory_order_relaxed);
+        Upstream *selected = nullptr;
+
+        for (size_t i = 0; i < count; i++) {
+            Upstream *upstream = upstreams_[(start + i) % count].get();
+            if (!upstream->healthy(now)) continue;
+            if (balancing_ == LoadBalancing::RoundRobin) return upstream;
+            if (selected == nullptr || upstream->active() < selected->active()) {
+                selected = upstream;
+            }
+        }
+        // all upstreams are down, keep trying them in turn rather than failing every request
+        return selected != nullptr ? selected : upstreams_[start % count].get();
+    }
+
+    void HttpFramer::Reset(bool head_request) {
+        state_ = State::Header;
+        header_.clear();
+        remaining_ = 0;
+        body_length_ = 0;
+        status_code_ = 0;
+        line_length_ = 0;
+        chunk_extension_ = false;
+        head_request_ = head_request;
+        keep_alive_ = true;
+    }
+
+    size_t HttpFramer::Feed(const char *data, size_t length) {
+        size_t pos = 0;
+
+        while (pos < length && state_ != State::Complete && state_ != State::Error) {
+            size_t start = pos;
+            bool in_body = state_ != State::Header;
+            switch (state_) {
+                case State::Header: {
+                    size_t old_size = header_.size();
+                    size_t count = std::min(length - pos, kMaxHeaderSize - old_size);
+                    header_.append(data + pos, count);
+                    size_t end = header_.find("\r\n\r\n", old_size >= 3 ? old_size - 3 : 0);
+                    if (end == std::string::npos) {
+                        if (header_.size() >= kMaxHeaderSize) state_ = State::Error;
+                        pos += count;
+                        break;
+                    }
+                    pos += end + 4 - old_size;
+                    header_.resize(end + 4);
+                    ParseHeader();
+                    break;
+                }
+                case State::Body:
+                case State::ChunkData: {
+                    size_t count = std::min(length - pos, remaining_);
+                    pos += count;
+                    remaining_ -= count;
+                    if (remaining_ == 0) {
+                        state_ = state_ == State::Body ? State::Complete : State::ChunkDataEnd;
+                    }
+                    break;
+                }
+                case State::ChunkSize: {
+                    char c = data[pos++];
+                    if (c == '\n') {
+                        if (line_length_ == 0) {
+                            state_ = State::Error;
+                        } else if (remaining_ == 0) {   // last chunk, trailer fields follow
+                            line_length_ = 0;
+                            state_ = State::Trailer;
+                        } else {
+                            state_ = State::ChunkData;
+                        }
+                    } else if (!chunk_extension_ && std::isxdigit(static_cast<unsigned char>(c))) {
+                        if (++line_length_ > 15) {
+                            state_ = State::Error;
+                            break;
+                        }
+                        int digit = std::isdigit(static_cast<unsigned char>(c)) ? c - '0' : std::tolower(c) - 'a' + 10;
+                        remaining_ = remaining_ * 16 + digit;
+                    } else {
+                        chunk_extension_ = true;
+                    }
+                    break;
+                }
+                case State::ChunkDataEnd:
+                    if (data[pos++] == '\n') {
+                        remaining_ = 0;
+                        line_length_ = 0;
+                        chunk_extension_ = false;
+                        state_ = State::ChunkSize;
+                    }
+                    break;
+                case State::Trailer: {
+                    char c = data[pos++];
+                    if (c == '\n') {
+                        if (line_length_ == 0) state_ = State::Complete;
+                        line_length_ = 0;
+                    } else if (c != '\r') {
+                        line_length_++;
+                    }
+                    break;
+                }
+                case State::UntilClose:
+                    pos = length;
+                    break;
+                default:
+                    break;
+            }
+            if (in_body) body_length_ += pos - start;
+        }
+        return pos;
+    }
+
+    void HttpFramer::ParseHeader() {
+        size_t lpos = 0, rpos = header_.find("\r\n");
+        std::string start_line = header_.substr(0, rpos);
+        bool chunked = false, has_length = false;
+        size_t content_length = 0;
+        int status_code = 0;
+
+        size_t first_space = start_line.find(' ');
+        if (first_space == std::string::npos) {
+            state_ = State::Error;
+            return;
+        }
+        if (kind_ == Kind::Request) {
+            head_request_ = start_line.compare(0, first_space, "HEAD") == 0;
+            keep_alive_ = start_line.length() < 8 || start_line.compare(start_line.length() - 8, 8, "HTTP/1.0") != 0;
+        } else {
+            status_code = std::atoi(start_line.c_str() + first_space + 1);
+            status_code_ = status_code;
+            keep_alive_ = start_line.compare(0, 8, "HTTP/1.0") != 0;
+        }
+
+        // header fields, names are case insensitive
+        for (lpos = rpos + 2; (rpos = header_.find("\r\n", lpos)) != lpos; lpos = rpos + 2) {
+            size_t colon = header_.find(':', lpos);
+            if (colon == std::string::npos || colon > rpos) continue;
+            std::string value = header_.substr(colon + 1, rpos - colon - 1);
+            std::transform(value.begin(), value.end(), value.begin(), [](char c) { return tolower(c); });
+            size_t name_length = colon - lpos;
+
+            if (name_length == 14 && strncasecmp(&header_[lpos], "Content-Length", 14) == 0) {
+                has_length = true;
+                content_length = std::strtoull(value.c_str(), nullptr, 10);
+            } else if (name_length == 17 && strncasecmp(&header_[lpos], "Transfer-Encoding", 17) == 0) {
+                chunked = value.find("chunked") != std::string::npos;
+            } else if (name_length == 10 && strncasecmp(&header_[lpos], "Connection", 10) == 0) {
+                if (value.find("close") != std::string::npos) keep_alive_ = false;
+                if (value.find("keep-alive") != std::string::npos) keep_alive_ = true;
+            }
+        }
+
+        if (kind_ == Kind::Response && status_code >= 100 && status_code < 200 && status_code != 101) {
+            header_.clear();                      // interim response, the final one follows
+            state_ = State::Header;
+        } else if (kind_ == Kind::Response && status_code == 101) {
+            keep_alive_ = false;                  // switched protocols, relay until either side closes
+            state_ = State::UntilClose;
+        } else if (kind_ == Kind::Response &&
+                   (head_request_ || status_code < 200 || status_code == 204 || status_code == 304)) {
+            state_ = State::Complete;
+        } else if (chunked) {
+            state_ = State::ChunkSize;
+        } else if (has_length || kind_ == Kind::Request) {
+            remaining_ = content_length;
+            state_ = content_length > 0 ? State::Body : State::Complete;
+        } else {
+            keep_alive_ = false;
+            state_ = State::UntilClose;
+        }
+    }
+
+}
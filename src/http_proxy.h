@@ -0,0 +1,128 @@
+#ifndef BASIC_HTTP_SERVER_HTTP_PROXY_H
+#define BASIC_HTTP_SERVER_HTTP_PROXY_H
+
+#include <netinet/in.h>
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace basic_http_server {
+
+    // Strategy used to pick an upstream server for every proxied request
+    enum class LoadBalancing {
+        RoundRobin,
+        LeastConnections
+    };
+
+    struct UpstreamAddress {
+        std::string host;   // IPv4 address
+        std::uint16_t port;
+    };
+
+    /**
+     * An upstream server shared by all worker threads
+     * Keep track of the number of active requests and the health of the server:
+     * after kMaxFailures consecutive failures the server is skipped for kRetryInterval.
+     */
+    class Upstream {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr int kMaxFailures = 3;
+        static constexpr std::chrono::seconds kRetryInterval{10};
+
+        explicit Upstream(const UpstreamAddress& address);
+
+        void ReportSuccess() { failures_ = 0; }
+        void ReportFailure(Clock::time_point now = Clock::now());
+        bool healthy(Clock::time_point now = Clock::now()) const;
+
+        const sockaddr_in& address() const { return address_; }
+        std::string host() const { return host_; }
+        std::uint16_t port() const { return port_; }
+        std::atomic<int>& active() { return active_; }
+
+    private:
+        std::string host_;
+        std::uint16_t port_;
+        sockaddr_in address_;
+        std::atomic<int> active_;
+        std::atomic<int> failures_;
+        std::atomic<Clock::rep> retry_at_;
+    };
+
+    // A proxy route forwards every request whose path starts with prefix to a group of upstreams
+    class ProxyRoute {
+    public:
+        ProxyRoute(const std::string& prefix, const std::vector<UpstreamAddress>& upstreams, LoadBalancing balancing);
+
+        // Pick a healthy upstream, or any upstream when all of them are down
+        Upstream* Select();
+
+        const std::string& prefix() const { return prefix_; }
+
+    private:
+        std::string prefix_;
+        LoadBalancing balancing_;
+        std::vector<std::unique_ptr<Upstream>> upstreams_;
+        std::atomic<size_t> next_;
+    };
+
+    /**
+     * Incremental scanner of a HTTP/1.1 message
+     * Find out where a request or response ends (Content-Length, chunked encoding or
+     * connection close) without buffering or decoding the body, so it can be streamed.
+     */
+    class HttpFramer {
+    public:
+        enum class Kind { Request, Response };
+
+        static constexpr size_t kMaxHeaderSize = 16384;
+
+        explicit HttpFramer(Kind kind) : kind_(kind) { Reset(); }
+
+        void Reset(bool head_request = false);
+        // Scan the next bytes of the message, return how many of them belong to this message
+        size_t Feed(const char *data, size_t length);
+
+        bool header_complete() const { return state_ != State::Header; }
+        bool complete() const { return state_ == State::Complete; }
+        bool error() const { return state_ == State::Error; }
+        bool until_close() const { return state_ == State::UntilClose; }
+        bool keep_alive() const { return keep_alive_; }
+        bool head_request() const { return head_request_; }
+        // Start line of the message and status code of a response, once the header is complete
+        std::string_view start_line() const {
+            return header_complete() ? std::string_view(header_).substr(0, header_.find("\r\n")) : std::string_view();
+        }
+        int status_code() const { return status_code_; }
+        // Bytes of the message after the header, chunk framing included
+        size_t body_length() const { return body_length_; }
+
+    private:
+        enum class State {
+            Header, Body, ChunkSize, ChunkData, ChunkDataEnd, Trailer, UntilClose, Complete, Error
+        };
+
+        Kind kind_;
+        State state_;
+        std::string header_;
+        size_t remaining_;
+        size_t body_length_;
+        int status_code_;
+        size_t line_length_;
+        bool chunk_extension_;
+        bool head_request_;
+        bool keep_alive_;
+
+        void ParseHeader();
+    };
+
+}
+
+#endif //BASIC_HTTP_SERVER_HTTP_PROXY_H
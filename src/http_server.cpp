@@ -4,10 +4,15 @@
 
 #include <unistd.h>
 #include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
 #include <sys/epoll.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <strings.h>
 
+#include <algorithm>
 #include <chrono>
 #include <cerrno>
 #include <cstring>
@@ -19,8 +24,94 @@
 
 namespace basic_http_server{
 
+    namespace {
+        // Path of the HTTP/1.1 request at the start of data: second token of the start line, up to the query
+        std::string_view request_path(const char *data, size_t length) {
+            const char *end = data + length;
+            const char *path_begin = std::find(data, end, ' ');
+            if (path_begin == end) return std::string_view();
+            const char *path_end = std::find(++path_begin, end, ' ');
+            return std::string_view(path_begin, std::find(path_begin, path_end, '?') - path_begin);
+        }
+
+        // Whether a comma separated header field value lists token, in any case
+        bool has_token(std::string_view value, std::string_view token) {
+            while (!value.empty()) {
+                size_t comma = value.find(',');
+                std::string_view item = value.substr(0, comma);
+                while (!item.empty() && (item.front() == ' ' || item.front() == '\t')) item.remove_prefix(1);
+                while (!item.empty() && (item.back() == ' ' || item.back() == '\t')) item.remove_suffix(1);
+                if (item.length() == token.length() && strncasecmp(item.data(), token.data(), token.length()) == 0) {
+                    return true;
+                }
+                if (comma == std::string_view::npos) break;
+                value.remove_prefix(comma + 1);
+            }
+            return false;
+        }
+
+        // Method, target and version of the HTTP/1.1 start line at the beginning of data, false if there is none
+        bool parse_start_line(std::string_view data, HttpMethod *method, std::string_view *target,
+                              HttpVersion *version) {
+            std::string_view line = data.substr(0, data.find("\r\n"));
+            size_t first = line.find(' '), last = line.rfind(' ');
+            if (first == std::string_view::npos || last == first) return false;
+            try {
+                *method = string_to_method(std::string(line.substr(0, first)));
+                *version = string_to_version(std::string(line.substr(last + 1)));
+            } catch (const std::invalid_argument&) {
+                return false;
+            }
+            *target = line.substr(first + 1, last - first - 1);
+            return true;
+        }
+
+        // Remove the Upgrade and HTTP2-Settings header fields of the request head at the start of data,
+        // upgrades are hop-by-hop and the proxy only relays HTTP/1.1. Return the new length of data.
+        size_t strip_upgrade(char *data, size_t length) {
+            char *end = data + length;
+            char *head_end = static_cast<char *>(memmem(data, length, "\r\n\r\n", 4));
+            if (head_end == nullptr) return length;
+            char *line = static_cast<char *>(memchr(data, '\n', length)) + 1;     // skip the start line
+            while (line < head_end + 2) {
+                char *next = static_cast<char *>(memchr(line, '\n', end - line)) + 1;
+                if (strncasecmp(line, "Upgrade:", 8) == 0 || strncasecmp(line, "HTTP2-Settings:", 15) == 0) {
+                    memmove(line, next, end - next);
+                    end -= next - line;
+                    head_end -= next - line;
+                } else {
+                    line = next;
+                }
+            }
+            return end - data;
+        }
+
+        // A route of map that another one of map matches too under the routing policy less, null if there is none
+        template <typename Map>
+        const Uri* find_collision(const Map& map, UriLess less) {
+            std::vector<const Uri*> uris;
+            for (const auto& p : map) uris.push_back(&p.first);
+            std::sort(uris.begin(), uris.end(), [less](const Uri *a, const Uri *b) { return less(*a, *b); });
+            auto it = std::adjacent_find(uris.begin(), uris.end(), [less](const Uri *a, const Uri *b) {
+                return !less(*a, *b);
+            });
+            return it != uris.end() ? *it : nullptr;
+        }
+
+        // Re-sort a route table for another routing policy, nodes are moved so values keep their address
+        template <typename Map>
+        void rekey(Map& map, UriLess less) {
+            Map rekeyed(less);
+            while (!map.empty()) {
+                rekeyed.insert(map.extract(map.begin()));
+            }
+            map.swap(rekeyed);
+        }
+    }
+
     HttpServer::HttpServer(const std::string &host, std::uint16_t port) :
-        host_(host), port_(port), sock_fd_(0), running_(false), worker_epoll_fd_(){
+        host_(host), port_(port), sock_fd_(0), running_(false), worker_epoll_fd_(),
+        tracer_(std::make_unique<Tracer>(kThreadPoolSize)) {
         InitSocket();
     }
 
@@ -47,6 +138,7 @@ namespace basic_http_server{
         }
 
         InitEpoll();
+        if (access_log_) access_log_->Start();
         running_ = true;
         listener_ = std::thread(&HttpServer::Listen, this);
         for (int i = 0; i < kThreadPoolSize; i++) {
@@ -61,9 +153,18 @@ namespace basic_http_server{
         for (int i = 0; i < kThreadPoolSize; i++) {
             workers_[i].join();
         }
-        // close epoll_fd
+        if (access_log_) access_log_->Stop();
+        // close epoll_fd and eventfd
         for (int i = 0; i < kThreadPoolSize; i++) {
             close(worker_epoll_fd_[i]);
+            close(wakeup_events_[i].fd);
+        }
+        // close idle upstream connections
+        for (auto& worker_connections : upstream_connections_) {
+            for (auto& p : worker_connections) {
+                for (int fd : p.second) close(fd);
+            }
+            worker_connections.clear();
         }
         // close socket
         close(sock_fd_);
@@ -79,6 +180,70 @@ namespace basic_http_server{
         request_handlers_[uri].insert(std::make_pair(method, std::move(callback)));
     }
 
+    void HttpServer::EnableAccessLog(const std::string &path) {
+        access_log_ = std::make_unique<AccessLog>(path, kThreadPoolSize);
+    }
+
+    void HttpServer::SetCaseInsensitiveRouting(bool enabled) {
+        // check every table first, rekey would keep only one of the colliding routes
+        for (const Uri *uri : {find_collision(request_handlers_, UriLess{enabled}),
+                               find_collision(route_rate_limiters_, UriLess{enabled}),
+                               find_collision(websocket_handlers_, UriLess{enabled})}) {
+            if (uri != nullptr) {
+                throw std::invalid_argument("Routes differ only in case: " + std::string(uri->path()));
+            }
+        }
+        rekey(request_handlers_, UriLess{enabled});
+        rekey(route_rate_limiters_, UriLess{enabled});
+        rekey(websocket_handlers_, UriLess{enabled});
+    }
+
+    void HttpServer::SetRateLimit(double requests_per_second, double burst) {
+        rate_limiter_ = std::make_unique<RateLimiter>(RateLimit{requests_per_second, burst});
+        InitTooManyRequests();
+    }
+
+    void HttpServer::SetRateLimit(const std::string &path, double requests_per_second, double burst) {
+        Uri uri(path);
+        route_rate_limiters_[uri] = std::make_unique<RateLimiter>(RateLimit{requests_per_second, burst});
+        InitTooManyRequests();
+    }
+
+    void HttpServer::RegisterProxyHandler(const std::string &path_prefix, const std::vector<UpstreamAddress> &upstreams,
+                                          LoadBalancing balancing) {
+        Uri uri(path_prefix);
+        proxy_routes_.push_back(std::make_unique<ProxyRoute>(std::string(uri.path()), upstreams, balancing));
+    }
+
+    void HttpServer::RegisterWebSocketHandler(const std::string &path, const WebSocketHandler &handler) {
+        Uri uri(path);
+        websocket_handlers_[uri] = handler;
+    }
+
+    void HttpServer::Broadcast(const std::string &path, const std::string &message, bool binary) {
+        auto it = websocket_handlers_.find(Uri(path));
+        if (it == websocket_handlers_.end() || !running_) return;
+
+        WebSocketFrame_t frame = websocket_frame(binary ? WebSocketOpcode::Binary : WebSocketOpcode::Text, message);
+        std::uint64_t signal = 1;
+        for (int i = 0; i < kThreadPoolSize; i++) {
+            {
+                std::lock_guard<std::mutex> lock(broadcast_queues_[i]->mutex);
+                broadcast_queues_[i]->frames.emplace_back(&it->second, frame);
+            }
+            if (write(wakeup_events_[i].fd, &signal, sizeof(signal)) < 0) {
+                // counter overflow only, the worker has a wake up pending anyway
+            }
+        }
+    }
+
+    void HttpServer::InitTooManyRequests() {
+        HttpResponse response(HttpStatusCode::TooManyRequests);
+        response.SetHeader("Retry-After", "1");
+        response.SetContent(std::string());
+        too_many_requests_ = to_string(response, true);
+    }
+
     void HttpServer::InitSocket() {
         if ((sock_fd_ = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0)) < 0) {
             throw std::runtime_error("Failed to create a TCP socket");
@@ -90,6 +255,13 @@ namespace basic_http_server{
             if ((worker_epoll_fd_[i] = epoll_create1(0)) < 0) {
                 throw std::runtime_error("Failed to create epoll file descriptor for worker");
             }
+            if ((wakeup_events_[i].fd = eventfd(0, EFD_NONBLOCK)) < 0) {
+                throw std::runtime_error("Failed to create event file descriptor for worker");
+            }
+            broadcast_queues_[i] = std::make_unique<BroadcastQueue>();
+            message_arenas_[i] = std::make_unique<MessageArena>();
+            buffer_pools_[i] = std::make_unique<BufferPool>(kMaxBufferSize, kMaxFreeBuffers);
+            ControlEpollEvent(worker_epoll_fd_[i], EPOLL_CTL_ADD, wakeup_events_[i].fd, EPOLLIN, &wakeup_events_[i]);
         }
     }
 
@@ -107,6 +279,7 @@ namespace basic_http_server{
 
             client_data = new Event();
             client_data->fd = client_fd;
+            client_data->address = client_address.sin_addr.s_addr;
             ControlEpollEvent(worker_epoll_fd_[current_worker], EPOLL_CTL_ADD, client_fd, EPOLLIN, client_data);
             current_worker++;
             if (current_worker == HttpServer::kThreadPoolSize) current_worker = 0;
@@ -121,89 +294,144 @@ namespace basic_http_server{
             if (event_nums < 0) {
                 continue;
             }
+            TRACE_ITERATION_BEGIN(*tracer_, worker_id, event_nums);
 
             for (int i = 0; i < event_nums; i++) {
                 const epoll_event& current_event = worker_events_[worker_id][i];
                 data = reinterpret_cast<Event *>(current_event.data.ptr);
-                if ((current_event.events & EPOLLHUP) || (current_event.events & EPOLLERR)) {
+                if (data->fd < 0) {                 // retired earlier in this batch
+                    continue;
+                } else if (data == &wakeup_events_[worker_id]) {
+                    DrainBroadcasts(worker_id);
+                } else if (data->websocket != nullptr) {
+                    HandleWebSocketEvent(worker_id, data, current_event.events);
+                } else if (data->proxy != nullptr) {
+                    HandleProxyEvent(worker_id, data, current_event.events);
+                } else if (data->http2 != nullptr) {
+                    HandleHttp2Event(worker_id, data, current_event.events);
+                } else if ((current_event.events & EPOLLHUP) || (current_event.events & EPOLLERR)) {
                     ControlEpollEvent(epoll_fd, EPOLL_CTL_DEL, data->fd);
                     close(data->fd);
-                    delete data;
+                    DeleteEvent(worker_id, data);
                 } else if ((current_event.events == EPOLLIN) || (current_event.events == EPOLLOUT)) {
-                    HandleEpollEvent(epoll_fd, data, current_event.events);
+                    HandleEpollEvent(worker_id, data, current_event.events);
                 } else {  // something unexpected, delete event
                     ControlEpollEvent(epoll_fd, EPOLL_CTL_DEL, data->fd);
                     close(data->fd);
-                    delete data;
+                    DeleteEvent(worker_id, data);
                 }
             }
+            if (!proxy_sessions_[worker_id].empty() &&
+                std::chrono::steady_clock::now() >= proxy_check_at_[worker_id]) {
+                ExpireProxySessions(worker_id);
+                proxy_check_at_[worker_id] = std::chrono::steady_clock::now() + kProxyCheckInterval;
+            }
+            // events deleted while relaying can only be freed once the batch is over
+            for (Event *event : retired_events_[worker_id]) delete event;
+            retired_events_[worker_id].clear();
+            TRACE_ITERATION_END(*tracer_, worker_id);
         }
     }
 
-    void HttpServer::HandleEpollEvent(int epoll_fd, Event *event, std::uint32_t events) {
+    void HttpServer::HandleEpollEvent(int worker_id, Event *event, std::uint32_t events) {
+        int epoll_fd = worker_epoll_fd_[worker_id];
         int fd = event->fd;
-        Event *request, *response;
 
+        // the same event serves every request of the connection, the response is written over the request
         if (events == EPOLLIN) {
             // EPOLLIN event, recv request, analyze and create response
-            request = event;
-            ssize_t byte_count = recv(fd, request->buffer, kMaxBufferSize, 0);
+            event->trace_id = TRACE_SAMPLE(*tracer_, worker_id);
+            TRACE_DISPATCH(*tracer_, worker_id, event->trace_id);
+            AcquireBuffer(worker_id, event);
+            TRACE_BEGIN(recv_start, event->trace_id);
+            ssize_t byte_count = recv(fd, event->buffer, kMaxBufferSize, 0);
+            TRACE_END(*tracer_, worker_id, "recv", event->trace_id, recv_start);
             if (byte_count > 0) {           // we have fully received the message
-                response = new Event();
-                response->fd = fd;
-                HandleHttpData(*request, response);
+                event->length = byte_count;
+                if (StartHttp2(worker_id, event) || StartWebSocket(worker_id, event)) {
+                    return;
+                }
+                std::string_view path = request_path(event->buffer, event->length);
+                ProxyRoute *route = MatchProxyRoute(path);
+                if (route != nullptr && AllowProxyRequest(route, path, event->address)) {
+                    StartProxy(worker_id, event, route);
+                    return;
+                }
+                if (route != nullptr) {
+                    RejectHttpRequest(worker_id, event);
+                } else {
+                    HandleHttpData(worker_id, event);
+                }
+                event->cursor = 0;
                 // add EPOLLOUT event
-                ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, fd, EPOLLOUT, response);
-                delete request;
+                ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, fd, EPOLLOUT, event);
             } else if (byte_count == 0) {   // client has closed connection
                 ControlEpollEvent(epoll_fd, EPOLL_CTL_DEL, fd);
                 close(fd);
-                delete request;
+                DeleteEvent(worker_id, event);
             } else {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {  // retry
-                    request->fd = fd;
-                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, fd, EPOLLIN, request);
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {  // retry, idle until then
+                    ReleaseBuffer(worker_id, event);
                 } else {                                        // other error
                     ControlEpollEvent(epoll_fd, EPOLL_CTL_DEL, fd);
                     close(fd);
-                    delete request;
+                    DeleteEvent(worker_id, event);
                 }
             }
         } else {
             // EPOLLOUT event, send response
-            response = event;
-            ssize_t byte_count = send(fd, response->buffer + response->cursor, response->length, 0);
+            TRACE_DISPATCH(*tracer_, worker_id, event->trace_id);
+            TRACE_BEGIN(send_start, event->trace_id);
+            ssize_t byte_count = send(fd, event->buffer + event->cursor, event->length, 0);
+            TRACE_END(*tracer_, worker_id, "send", event->trace_id, send_start);
             if (byte_count >= 0) {
-                if (byte_count < response->length) {  // there are still bytes to write
-                    response->cursor += byte_count;
-                    response->length -= byte_count;
-                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, fd, EPOLLOUT, response);
+                if (byte_count < event->length) {     // there are still bytes to write
+                    event->cursor += byte_count;
+                    event->length -= byte_count;
                 } else {                              // we have written the complete message
-                    request = new Event();
-                    request->fd = fd;
-                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, fd, EPOLLIN, request);
-                    delete response;
+                    ReleaseBuffer(worker_id, event);
+                    event->trace_id = 0;
+                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, fd, EPOLLIN, event);
                 }
             } else {
-                if (errno == EAGAIN || errno == EWOULDBLOCK) {  // retry
-                    ControlEpollEvent(epoll_fd, EPOLL_CTL_ADD, fd, EPOLLOUT, response);
-                } else {                                        // other error
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {  // other error, otherwise retry
                     ControlEpollEvent(epoll_fd, EPOLL_CTL_DEL, fd);
                     close(fd);
-                    delete response;
+                    DeleteEvent(worker_id, event);
                 }
             }
         }
     }
 
-    void HttpServer::HandleHttpData(const Event& request_event, Event* response_event) {
-        std::string request_string(request_event.buffer), response_string;
-        HttpRequest http_request;
+    void HttpServer::HandleHttpData(int worker_id, Event* event) {
+        // the parsed request lives in the arena, released at once when the response is copied out;
+        // the response comes from the handler and uses the default resource
+        MessageArena& arena = *message_arenas_[worker_id];
+        MessageArena::Scope arena_scope(arena);
+        auto start = std::chrono::steady_clock::now();
+        std::string_view request_string(event->buffer, strnlen(event->buffer, event->length));
+        std::string response_string;
+        HttpRequest http_request(arena.resource());
         HttpResponse http_response;
 
+        // per peer limit is checked before parsing so abusive clients cost as little as possible
+        if (rate_limiter_ && !rate_limiter_->Allow(event->address)) {
+            RejectHttpRequest(worker_id, event);
+            return;
+        }
+
         try {
-            http_request = string_to_request(request_string);
+            TRACE_BEGIN(parse_start, event->trace_id);
+            http_request = string_to_request(request_string, arena.resource());
+            TRACE_END(*tracer_, worker_id, "parse", event->trace_id, parse_start);
+            auto limiter_it = route_rate_limiters_.find(http_request.uri());
+            if (limiter_it != route_rate_limiters_.end() && !limiter_it->second->Allow(event->address)) {
+                RejectHttpRequest(worker_id, event);
+                return;
+            }
+            TRACE_BEGIN(handler_start, event->trace_id);
             http_response = HandleHttpRequest(http_request);
+            TRACE_END(*tracer_, worker_id, "handler", event->trace_id, handler_start);
         } catch (const std::invalid_argument& e) {
             http_response = HttpResponse(HttpStatusCode::BadRequest);
             http_response.SetContent(e.what());
@@ -215,10 +443,38 @@ namespace basic_http_server{
             http_response.SetContent(e.what());
         }
 
-        // Set response to write to client
+        // Set response to write to client, the request has been parsed so its bytes can be overwritten
+        TRACE_BEGIN(serialize_start, event->trace_id);
         response_string = to_string(http_response, http_request.method() != HttpMethod::HEAD);
-        strncpy(response_event->buffer, response_string.c_str(), kMaxBufferSize);
-        response_event->length = response_string.length();
+        TRACE_END(*tracer_, worker_id, "serialize", event->trace_id, serialize_start);
+        event->length = std::min(response_string.length(), kMaxBufferSize);
+        memcpy(event->buffer, response_string.data(), event->length);
+        if (access_log_) LogAccess(worker_id, event->address, http_request, http_response, start);
+    }
+
+    void HttpServer::RejectHttpRequest(int worker_id, Event *event) {
+        // logged from the start line, the request is not parsed
+        if (access_log_) {
+            LogAccess(worker_id, event->address, std::string_view(event->buffer, event->length),
+                      static_cast<int>(HttpStatusCode::TooManyRequests), 0, std::chrono::steady_clock::now());
+        }
+        size_t length = std::min(too_many_requests_.length(), kMaxBufferSize);
+        memcpy(event->buffer, too_many_requests_.data(), length);
+        event->length = length;
+    }
+
+    void HttpServer::ReplyHttp(int worker_id, Event *event, HttpResponse response) {
+        response.SetContent(to_string(response.status_code()));
+        if (access_log_) {
+            LogAccess(worker_id, event->address, std::string_view(event->buffer, event->length),
+                      static_cast<int>(response.status_code()), response.content_length(),
+                      std::chrono::steady_clock::now());
+        }
+        std::string response_string = to_string(response, true);
+        event->length = std::min(response_string.length(), kMaxBufferSize);
+        event->cursor = 0;
+        memcpy(event->buffer, response_string.data(), event->length);
+        ControlEpollEvent(worker_epoll_fd_[worker_id], EPOLL_CTL_MOD, event->fd, EPOLLOUT, event);
     }
 
     HttpResponse HttpServer::HandleHttpRequest(const HttpRequest &request) {
@@ -236,6 +492,669 @@ namespace basic_http_server{
         return callback_it->second(request);    // call handler to process the request
     }
 
+    bool HttpServer::StartHttp2(int worker_id, Event *event) {
+        bool prior_knowledge = event->length >= 3 &&
+            memcmp(event->buffer, kHttp2Preface, std::min(event->length, kHttp2PrefaceLength)) == 0;
+        HttpRequest upgrade_request;
+
+        if (!prior_knowledge) {
+            // HTTP/1.1 request with "Upgrade: h2c" https://www.rfc-editor.org/rfc/rfc7540#section-3.2
+            if (memmem(event->buffer, event->length, "h2c", 3) == nullptr) return false;
+            try {
+                upgrade_request = string_to_request(std::string(event->buffer, event->length));
+            } catch (const std::exception&) {
+                return false;
+            }
+            if (upgrade_request.header("Upgrade") != "h2c" || upgrade_request.header("HTTP2-Settings").empty()) {
+                return false;
+            }
+            // proxied requests stay on HTTP/1.1, the upgrade is optional for the server
+            if (MatchProxyRoute(upgrade_request.uri().path()) != nullptr) return false;
+            upgrade_request.SetVersion(HttpVersion::HTTP_2_0);      // served as stream 1
+        }
+
+        std::uint32_t address = event->address;
+        // the proxy relays HTTP/1.1 only, its routes are refused on HTTP/2 streams
+        event->http2 = new Http2Connection([this, worker_id, address](const HttpRequest& request) {
+            return HandleHttp2Request(worker_id, request, address);
+        }, [this](const HttpRequest& request) {
+            return MatchProxyRoute(request.uri().path()) != nullptr;
+        });
+        if (prior_knowledge) {
+            event->http2->Start();
+            event->http2->Feed(event->buffer, event->length);
+        } else {
+            event->http2->Start(upgrade_request, std::string(upgrade_request.header("HTTP2-Settings")));
+        }
+        ReleaseBuffer(worker_id, event);        // the connection keeps a copy of what it still needs
+        FlushHttp2(worker_id, event);
+        return true;
+    }
+
+    void HttpServer::HandleHttp2Event(int worker_id, Event *event, std::uint32_t events) {
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            CloseHttp2(worker_id, event);
+        } else if (events & EPOLLIN) {
+            AcquireBuffer(worker_id, event);
+            ssize_t byte_count = recv(event->fd, event->buffer, kMaxBufferSize, 0);
+            bool closed = byte_count == 0 || (byte_count < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+            if (byte_count > 0) event->http2->Feed(event->buffer, byte_count);
+            ReleaseBuffer(worker_id, event);
+            if (closed) {
+                CloseHttp2(worker_id, event);
+            } else if (byte_count > 0) {
+                FlushHttp2(worker_id, event);
+            }
+        } else if (events & EPOLLOUT) {
+            FlushHttp2(worker_id, event);
+        }
+    }
+
+    void HttpServer::FlushHttp2(int worker_id, Event *event) {
+        Http2Connection *connection = event->http2;
+        while (connection->output_size() > 0) {
+            ssize_t byte_count = send(event->fd, connection->output(), connection->output_size(), MSG_NOSIGNAL);
+            if (byte_count < 0) {
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {  // wait until the socket is writable again
+                    ControlEpollEvent(worker_epoll_fd_[worker_id], EPOLL_CTL_MOD, event->fd, EPOLLOUT, event);
+                } else {
+                    CloseHttp2(worker_id, event);
+                }
+                return;
+            }
+            connection->Consume(byte_count);
+        }
+
+        if (connection->closed()) {
+            CloseHttp2(worker_id, event);
+        } else {
+            ControlEpollEvent(worker_epoll_fd_[worker_id], EPOLL_CTL_MOD, event->fd, EPOLLIN, event);
+        }
+    }
+
+    void HttpServer::CloseHttp2(int worker_id, Event *event) {
+        ControlEpollEvent(worker_epoll_fd_[worker_id], EPOLL_CTL_DEL, event->fd);
+        close(event->fd);
+        delete event->http2;
+        DeleteEvent(worker_id, event);
+    }
+
+    HttpResponse HttpServer::HandleHttp2Request(int worker_id, const HttpRequest &request, std::uint32_t address) {
+        auto start = std::chrono::steady_clock::now();
+        HttpResponse response;
+        auto limiter_it = route_rate_limiters_.find(request.uri());
+        if ((rate_limiter_ && !rate_limiter_->Allow(address)) ||
+            (limiter_it != route_rate_limiters_.end() && !limiter_it->second->Allow(address))) {
+            response = HttpResponse(HttpStatusCode::TooManyRequests);
+            response.SetHeader("Retry-After", "1");
+            response.SetContent(std::string());
+        } else {
+            response = HandleHttpRequest(request);
+        }
+        if (access_log_) LogAccess(worker_id, address, request, response, start);
+        return response;
+    }
+
+    void HttpServer::LogAccess(int worker_id, std::uint32_t address, const HttpRequest &request,
+                               const HttpResponse &response, std::chrono::steady_clock::time_point start) {
+        LogAccess(worker_id, address, request.method(), request.version(), request.uri().target(),
+                  static_cast<int>(response.status_code()),
+                  request.method() != HttpMethod::HEAD ? response.content_length() : 0, start);
+    }
+
+    void HttpServer::LogAccess(int worker_id, std::uint32_t address, std::string_view start_line, int status_code,
+                               std::uint64_t bytes, std::chrono::steady_clock::time_point start) {
+        HttpMethod method;
+        HttpVersion version;
+        std::string_view target;
+        if (parse_start_line(start_line, &method, &target, &version)) {
+            LogAccess(worker_id, address, method, version, target, status_code, bytes, start);
+        }
+    }
+
+    void HttpServer::LogAccess(int worker_id, std::uint32_t address, HttpMethod method, HttpVersion version,
+                               std::string_view target, int status_code, std::uint64_t bytes,
+                               std::chrono::steady_clock::time_point start) {
+        AccessLogRecord record;
+        record.time = std::time(nullptr);
+        record.bytes = bytes;
+        record.address = address;
+        record.latency_us = static_cast<std::uint32_t>(
+            std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+        record.status_code = static_cast<std::uint16_t>(status_code);
+        record.method = static_cast<std::uint8_t>(method);
+        record.version = static_cast<std::uint8_t>(version);
+        record.SetTarget(target);
+        access_log_->Push(worker_id, record);       // dropped and counted if the ring is full
+    }
+
+    bool HttpServer::StartWebSocket(int worker_id, Event *event) {
+        if (websocket_handlers_.empty() || memmem(event->buffer, event->length, "ebsocket", 8) == nullptr) {
+            return false;
+        }
+
+        // opening handshake https://www.rfc-editor.org/rfc/rfc6455#section-4.2
+        HttpRequest request;
+        try {
+            request = string_to_request(std::string(event->buffer, event->length));
+        } catch (const std::exception&) {
+            return false;
+        }
+        auto it = websocket_handlers_.find(request.uri());
+        std::string upgrade(request.header("Upgrade")), key(request.header("Sec-WebSocket-Key"));
+        std::transform(upgrade.begin(), upgrade.end(), upgrade.begin(), [](char c) { return tolower(c); });
+        if (it == websocket_handlers_.end() || upgrade != "websocket") return false;
+
+        // handshakes are rate limited like any other request
+        auto limiter_it = route_rate_limiters_.find(request.uri());
+        if ((rate_limiter_ && !rate_limiter_->Allow(event->address)) ||
+            (limiter_it != route_rate_limiters_.end() && !limiter_it->second->Allow(event->address))) {
+            RejectHttpRequest(worker_id, event);
+            event->cursor = 0;
+            ControlEpollEvent(worker_epoll_fd_[worker_id], EPOLL_CTL_MOD, event->fd, EPOLLOUT, event);
+            return true;
+        }
+        if (request.method() != HttpMethod::GET || key.empty() || !has_token(request.header("Connection"), "Upgrade")) {
+            ReplyHttp(worker_id, event, HttpResponse(HttpStatusCode::BadRequest));
+            return true;
+        }
+        if (request.header("Sec-WebSocket-Version") != "13") {     // the only version there is
+            HttpResponse response(HttpStatusCode::UpgradeRequired);
+            response.SetHeader("Sec-WebSocket-Version", "13");
+            ReplyHttp(worker_id, event, std::move(response));
+            return true;
+        }
+
+        auto connection = new WebSocketConnection(&it->second);
+        connection->Enqueue(std::make_shared<const std::string>(
+            "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\nConnection: Upgrade\r\n"
+            "Sec-WebSocket-Accept: " + websocket_accept_key(key) + "\r\n\r\n"));
+        event->websocket = connection;
+        if (access_log_) {
+            LogAccess(worker_id, event->address, request, HttpResponse(HttpStatusCode::SwitchingProtocols),
+                      std::chrono::steady_clock::now());
+        }
+        ReleaseBuffer(worker_id, event);
+
+        auto& subscribers = websocket_subscribers_[worker_id][&it->second];
+        connection->set_subscriber_index(subscribers.size());
+        subscribers.push_back(event);
+        if (it->second.on_open) it->second.on_open(*connection);
+        FlushWebSocket(worker_id, event);
+        return true;
+    }
+
+    void HttpServer::HandleWebSocketEvent(int worker_id, Event *event, std::uint32_t events) {
+        if (events & (EPOLLERR | EPOLLHUP)) {
+            CloseWebSocket(worker_id, event);
+            return;
+        }
+        if (events & EPOLLIN) {
+            AcquireBuffer(worker_id, event);
+            ssize_t byte_count = recv(event->fd, event->buffer, kMaxBufferSize, 0);
+            bool closed = byte_count == 0 || (byte_count < 0 && errno != EAGAIN && errno != EWOULDBLOCK);
+            if (byte_count > 0) event->websocket->Feed(event->buffer, byte_count);
+            ReleaseBuffer(worker_id, event);
+            if (closed) {
+                CloseWebSocket(worker_id, event);
+                return;
+            }
+        }
+        FlushWebSocket(worker_id, event);
+    }
+
+    void HttpServer::FlushWebSocket(int worker_id, Event *event) {
+        WebSocketConnection *connection = event->websocket;
+        if (connection->overflow()) {       // slow consumer
+            CloseWebSocket(worker_id, event);
+            return;
+        }
+
+        // queued frames are written straight from the shared buffers
+        while (connection->output_pending()) {
+            iovec iov[kMaxWebSocketIov];
+            msghdr message = {};
+            message.msg_iov = iov;
+            message.msg_iovlen = connection->PrepareOutput(iov, kMaxWebSocketIov);
+            ssize_t byte_count = sendmsg(event->fd, &message, MSG_NOSIGNAL);
+            if (byte_count < 0) {
+                if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                    CloseWebSocket(worker_id, event);
+                } else if (!connection->waiting_writable()) {
+                    connection->set_waiting_writable(true);
+                    ControlEpollEvent(worker_epoll_fd_[worker_id], EPOLL_CTL_MOD, event->fd, EPOLLIN | EPOLLOUT, event);
+                }
+                return;
+            }
+            connection->Consume(byte_count);
+        }
+
+        if (connection->closing()) {        // close frame sent
+            CloseWebSocket(worker_id, event);
+        } else if (connection->waiting_writable()) {
+            connection->set_waiting_writable(false);
+            ControlEpollEvent(worker_epoll_fd_[worker_id], EPOLL_CTL_MOD, event->fd, EPOLLIN, event);
+        }
+    }
+
+    void HttpServer::CloseWebSocket(int worker_id, Event *event) {
+        WebSocketConnection *connection = event->websocket;
+        if (connection->handler()->on_close) connection->handler()->on_close(*connection);
+
+        auto& subscribers = websocket_subscribers_[worker_id][connection->handler()];
+        size_t index = connection->subscriber_index();
+        subscribers[index] = subscribers.back();
+        subscribers[index]->websocket->set_subscriber_index(index);
+        subscribers.pop_back();
+
+        ControlEpollEvent(worker_epoll_fd_[worker_id], EPOLL_CTL_DEL, event->fd);
+        close(event->fd);
+        delete connection;
+        RetireEvent(worker_id, event);
+    }
+
+    void HttpServer::DrainBroadcasts(int worker_id) {
+        std::uint64_t signal;
+        if (read(wakeup_events_[worker_id].fd, &signal, sizeof(signal)) < 0) return;
+
+        std::vector<std::pair<const WebSocketHandler*, WebSocketFrame_t>> frames;
+        {
+            std::lock_guard<std::mutex> lock(broadcast_queues_[worker_id]->mutex);
+            frames.swap(broadcast_queues_[worker_id]->frames);
+        }
+
+        std::vector<Event*> subscribers;
+        for (const auto& p : frames) {
+            auto it = websocket_subscribers_[worker_id].find(p.first);
+            if (it == websocket_subscribers_[worker_id].end()) continue;
+            for (Event *event : it->second) {
+                event->websocket->Enqueue(p.second);
+            }
+            subscribers.insert(subscribers.end(), it->second.begin(), it->second.end());
+        }
+        // flushing may close connections, which modifies the subscriber lists
+        std::sort(subscribers.begin(), subscribers.end());
+        subscribers.erase(std::unique(subscribers.begin(), subscribers.end()), subscribers.end());
+        for (Event *event : subscribers) {
+            if (event->fd >= 0) FlushWebSocket(worker_id, event);
+        }
+    }
+
+    ProxyRoute* HttpServer::MatchProxyRoute(std::string_view path) const {
+        if (proxy_routes_.empty()) return nullptr;
+        bool ignore_case = request_handlers_.key_comp().ignore_case;
+
+        ProxyRoute *match = nullptr;
+        for (const auto& route : proxy_routes_) {
+            const std::string& prefix = route->prefix();
+            // whole segments only, /api matches /api and /api/x but not /apiary
+            bool boundary = path.length() == prefix.length() || prefix.empty() || prefix.back() == '/' ||
+                            (path.length() > prefix.length() && path[prefix.length()] == '/');
+            if (path.length() >= prefix.length() && boundary &&
+                (ignore_case ? strncasecmp(path.data(), prefix.data(), prefix.length()) == 0
+                             : path.compare(0, prefix.length(), prefix) == 0) &&
+                (match == nullptr || prefix.length() > match->prefix().length())) {
+                match = route.get();
+            }
+        }
+        return match;
+    }
+
+    bool HttpServer::AllowProxyRequest(const ProxyRoute *route, std::string_view path, std::uint32_t address) {
+        if (rate_limiter_ && !rate_limiter_->Allow(address)) return false;
+        if (route_rate_limiters_.empty()) return true;
+        // a limit set on the exact path wins over one set on the prefix of the route
+        auto it = route_rate_limiters_.find(Uri(path));
+        if (it == route_rate_limiters_.end()) it = route_rate_limiters_.find(Uri(route->prefix()));
+        return it == route_rate_limiters_.end() || it->second->Allow(address);
+    }
+
+    void HttpServer::StartProxy(int worker_id, Event *client, ProxyRoute *route) {
+        int epoll_fd = worker_epoll_fd_[worker_id];
+        auto session = new ProxySession();
+        session->client = client;
+        session->route = route;
+        // drop pipelined bytes past the first request, they are not supported
+        client->length = strip_upgrade(client->buffer, client->length);
+        client->length = session->request.Feed(client->buffer, client->length);
+        client->cursor = 0;
+        if (session->request.error()) {
+            ReplyProxyError(worker_id, session, HttpStatusCode::BadRequest);
+            delete session;
+            return;
+        }
+        session->response.Reset(session->request.head_request());
+
+        int upstream_fd = ConnectUpstream(worker_id, session);
+        if (upstream_fd < 0) {
+            ReplyProxyError(worker_id, session, HttpStatusCode::BadGateway);
+            delete session;
+            return;
+        }
+        session->upstream = new Event();
+        session->upstream->fd = upstream_fd;
+        AcquireBuffer(worker_id, session->upstream);   // both buffers are held until the exchange is over
+        session->upstream->proxy = session;
+        client->proxy = session;
+        session->index = proxy_sessions_[worker_id].size();
+        session->deadline = std::chrono::steady_clock::now() + proxy_timeout_;
+        proxy_sessions_[worker_id].push_back(session);
+
+        // the client stays quiet until the upstream has taken the bytes already received
+        ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, client->fd, 0, client);
+        ControlEpollEvent(epoll_fd, EPOLL_CTL_ADD, upstream_fd, EPOLLOUT, session->upstream);
+    }
+
+    void HttpServer::HandleProxyEvent(int worker_id, Event *event, std::uint32_t events) {
+        int epoll_fd = worker_epoll_fd_[worker_id];
+        ProxySession *session = event->proxy;
+        Event *client = session->client, *upstream = session->upstream;
+        ssize_t byte_count;
+        session->deadline = std::chrono::steady_clock::now() + proxy_timeout_;
+
+        if (event == upstream) {
+            if (!session->connected) {      // non-blocking connect has finished
+                int error = 0;
+                socklen_t length = sizeof(error);
+                if (getsockopt(upstream->fd, SOL_SOCKET, SO_ERROR, &error, &length) < 0 || error != 0) {
+                    if (session->attempts < kMaxProxyAttempts) {
+                        RetryProxy(worker_id, session);
+                    } else {
+                        AbortProxy(worker_id, session, true);
+                    }
+                    return;
+                }
+                session->connected = true;
+            }
+            if (events & EPOLLERR) {
+                AbortProxy(worker_id, session, true);
+                return;
+            }
+
+            if (events & EPOLLOUT) {
+                // forward request bytes to the upstream
+                byte_count = send(upstream->fd, client->buffer + client->cursor, client->length - client->cursor,
+                                  MSG_NOSIGNAL);
+                if (byte_count < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) AbortProxy(worker_id, session, true);
+                    return;
+                }
+                client->cursor += byte_count;
+                if (client->cursor < client->length) return;
+                client->cursor = client->length = 0;
+                if (session->request.complete()) {          // wait for the response
+                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, upstream->fd, EPOLLIN, upstream);
+                } else {                                    // read more of the request body
+                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, upstream->fd, 0, upstream);
+                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, client->fd, EPOLLIN, client);
+                }
+            } else if (events & (EPOLLIN | EPOLLHUP)) {
+                // read response bytes from the upstream, once the client has taken the previous ones
+                if (upstream->cursor < upstream->length) return;
+                byte_count = recv(upstream->fd, upstream->buffer, kMaxBufferSize, 0);
+                if (byte_count > 0) {
+                    upstream->length = session->response.Feed(upstream->buffer, byte_count);
+                    upstream->cursor = 0;
+                    if (session->response.error()) {
+                        AbortProxy(worker_id, session, true);
+                        return;
+                    }
+                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, upstream->fd, 0, upstream);
+                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, client->fd, EPOLLOUT, client);
+                } else if (byte_count == 0 && session->response.until_close()) {
+                    FinishProxy(worker_id, session);
+                } else if (byte_count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    AbortProxy(worker_id, session, true);
+                }
+            }
+        } else {
+            if (events & (EPOLLERR | EPOLLHUP)) {
+                AbortProxy(worker_id, session, false);
+                return;
+            }
+
+            if (events & EPOLLIN) {
+                // read more of the request body from the client
+                byte_count = recv(client->fd, client->buffer, kMaxBufferSize, 0);
+                if (byte_count > 0) {
+                    client->length = session->request.Feed(client->buffer, byte_count);
+                    client->cursor = 0;
+                    if (session->request.error()) {
+                        AbortProxy(worker_id, session, false);
+                        return;
+                    }
+                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, client->fd, 0, client);
+                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, upstream->fd, EPOLLOUT, upstream);
+                } else if (byte_count == 0 || (errno != EAGAIN && errno != EWOULDBLOCK)) {
+                    AbortProxy(worker_id, session, false);
+                }
+            } else if (events & EPOLLOUT) {
+                // forward response bytes to the client
+                byte_count = send(client->fd, upstream->buffer + upstream->cursor, upstream->length - upstream->cursor,
+                                  MSG_NOSIGNAL);
+                if (byte_count < 0) {
+                    if (errno != EAGAIN && errno != EWOULDBLOCK) AbortProxy(worker_id, session, false);
+                    return;
+                }
+                session->response_started = true;
+                upstream->cursor += byte_count;
+                if (upstream->cursor < upstream->length) return;
+                upstream->cursor = upstream->length = 0;
+                if (session->response.complete()) {
+                    FinishProxy(worker_id, session);
+                } else {
+                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, client->fd, 0, client);
+                    ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, upstream->fd, EPOLLIN, upstream);
+                }
+            }
+        }
+    }
+
+    void HttpServer::RetryProxy(int worker_id, ProxySession *session) {
+        // nothing has been sent yet, so the request can go to another upstream
+        int epoll_fd = worker_epoll_fd_[worker_id];
+        Event *upstream = session->upstream;
+
+        session->server->active()--;
+        session->server->ReportFailure();
+        ControlEpollEvent(epoll_fd, EPOLL_CTL_DEL, upstream->fd);
+        close(upstream->fd);
+
+        session->attempts++;
+        upstream->fd = ConnectUpstream(worker_id, session);
+        if (upstream->fd < 0) {
+            session->client->proxy = nullptr;
+            ReplyProxyError(worker_id, session, HttpStatusCode::BadGateway);
+            RetireEvent(worker_id, upstream);
+            EndProxySession(worker_id, session);
+            return;
+        }
+        session->deadline = std::chrono::steady_clock::now() + proxy_timeout_;
+        ControlEpollEvent(epoll_fd, EPOLL_CTL_ADD, upstream->fd, EPOLLOUT, upstream);
+    }
+
+    int HttpServer::ConnectUpstream(int worker_id, ProxySession *session) {
+        for (; session->attempts <= kMaxProxyAttempts; session->attempts++) {
+            session->server = session->route->Select();
+            int fd = AcquireUpstreamConnection(worker_id, session->server, &session->connected);
+            if (fd >= 0) {
+                session->server->active()++;
+                return fd;
+            }
+            session->server->ReportFailure();
+        }
+        return -1;
+    }
+
+    void HttpServer::FinishProxy(int worker_id, ProxySession *session) {
+        int epoll_fd = worker_epoll_fd_[worker_id];
+        Event *client = session->client, *upstream = session->upstream;
+
+        session->server->active()--;
+        session->server->ReportSuccess();
+        if (access_log_) {
+            LogAccess(worker_id, client->address, session->request.start_line(), session->response.status_code(),
+                      session->response.body_length(), session->start);
+        }
+        ControlEpollEvent(epoll_fd, EPOLL_CTL_DEL, upstream->fd);
+        if (session->response.complete() && session->response.keep_alive() && session->request.keep_alive()) {
+            ReleaseUpstreamConnection(worker_id, session->server, upstream->fd);
+        } else {
+            close(upstream->fd);
+        }
+
+        if (session->response.complete()) {     // wait for the next request of the client
+            Event *request = new Event();
+            request->fd = client->fd;
+            request->address = client->address;
+            ControlEpollEvent(epoll_fd, EPOLL_CTL_MOD, client->fd, EPOLLIN, request);
+        } else {                                // response delimited by closing the connection
+            ControlEpollEvent(epoll_fd, EPOLL_CTL_DEL, client->fd);
+            close(client->fd);
+        }
+        RetireEvent(worker_id, client);
+        RetireEvent(worker_id, upstream);
+        EndProxySession(worker_id, session);
+    }
+
+    void HttpServer::AbortProxy(int worker_id, ProxySession *session, bool upstream_failed) {
+        int epoll_fd = worker_epoll_fd_[worker_id];
+        Event *client = session->client, *upstream = session->upstream;
+
+        session->server->active()--;
+        if (upstream_failed) session->server->ReportFailure();
+        ControlEpollEvent(epoll_fd, EPOLL_CTL_DEL, upstream->fd);
+        close(upstream->fd);
+        RetireEvent(worker_id, upstream);
+
+        if (upstream_failed && !session->response_started) {
+            client->proxy = nullptr;
+            ReplyProxyError(worker_id, session, HttpStatusCode::BadGateway);
+        } else {
+            // 499 as in nginx: the client closed the connection before the response was complete
+            if (access_log_) {
+                LogAccess(worker_id, client->address, session->request.start_line(),
+                          session->response.header_complete() ? session->response.status_code() : 499,
+                          session->response.body_length(), session->start);
+            }
+            ControlEpollEvent(epoll_fd, EPOLL_CTL_DEL, client->fd);
+            close(client->fd);
+            RetireEvent(worker_id, client);
+        }
+        EndProxySession(worker_id, session);
+    }
+
+    void HttpServer::ExpireProxySessions(int worker_id) {
+        auto now = std::chrono::steady_clock::now();
+        std::vector<ProxySession*> expired;
+        for (ProxySession *session : proxy_sessions_[worker_id]) {
+            if (session->deadline <= now) expired.push_back(session);
+        }
+
+        for (ProxySession *session : expired) {
+            if (!session->connected && session->attempts < kMaxProxyAttempts) {   // connect timed out
+                RetryProxy(worker_id, session);
+                continue;
+            }
+            // the upstream is only blamed when the proxy was waiting for it, not for a slow client
+            const Event *client = session->client, *upstream = session->upstream;
+            bool client_stalled = (!session->request.complete() && client->cursor >= client->length) ||
+                                  upstream->cursor < upstream->length;
+            AbortProxy(worker_id, session, !client_stalled);
+        }
+    }
+
+    void HttpServer::EndProxySession(int worker_id, ProxySession *session) {
+        auto& sessions = proxy_sessions_[worker_id];
+        sessions[session->index] = sessions.back();
+        sessions[session->index]->index = session->index;
+        sessions.pop_back();
+        delete session;
+    }
+
+    void HttpServer::ReplyProxyError(int worker_id, ProxySession *session, HttpStatusCode status_code) {
+        Event *client = session->client;
+        HttpResponse http_response(status_code);
+        http_response.SetContent(to_string(status_code));
+        std::string response_string = to_string(http_response, true);
+        if (access_log_) {
+            LogAccess(worker_id, client->address, session->request.start_line(), static_cast<int>(status_code),
+                      http_response.content_length(), session->start);
+        }
+
+        auto response = new Event();
+        response->fd = client->fd;
+        response->address = client->address;
+        AcquireBuffer(worker_id, response);
+        response->length = std::min(response_string.length(), kMaxBufferSize);
+        memcpy(response->buffer, response_string.data(), response->length);
+        ControlEpollEvent(worker_epoll_fd_[worker_id], EPOLL_CTL_MOD, client->fd, EPOLLOUT, response);
+        RetireEvent(worker_id, client);
+    }
+
+    int HttpServer::AcquireUpstreamConnection(int worker_id, const Upstream *upstream, bool *connected) {
+        auto& idle_connections = upstream_connections_[worker_id][upstream];
+        while (!idle_connections.empty()) {
+            int fd = idle_connections.back();
+            idle_connections.pop_back();
+            // an idle connection must have nothing to read, otherwise the upstream has closed it
+            char c;
+            if (recv(fd, &c, 1, MSG_PEEK | MSG_DONTWAIT) < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                *connected = true;
+                return fd;
+            }
+            close(fd);
+        }
+
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK, 0);
+        if (fd < 0) return -1;
+        int opt = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &opt, sizeof(opt));
+        if (connect(fd, (const sockaddr *)&upstream->address(), sizeof(sockaddr_in)) == 0) {
+            *connected = true;
+            return fd;
+        }
+        if (errno == EINPROGRESS) {
+            *connected = false;
+            return fd;
+        }
+        close(fd);
+        return -1;
+    }
+
+    void HttpServer::ReleaseUpstreamConnection(int worker_id, const Upstream *upstream, int fd) {
+        auto& idle_connections = upstream_connections_[worker_id][upstream];
+        if (idle_connections.size() < kMaxIdleUpstreamConnections) {
+            idle_connections.push_back(fd);
+        } else {
+            close(fd);
+        }
+    }
+
+    void HttpServer::RetireEvent(int worker_id, Event *event) {
+        ReleaseBuffer(worker_id, event);
+        event->fd = -1;
+        event->proxy = nullptr;
+        event->http2 = nullptr;
+        event->websocket = nullptr;
+        retired_events_[worker_id].push_back(event);
+    }
+
+    void HttpServer::AcquireBuffer(int worker_id, Event *event) {
+        if (event->buffer == nullptr) event->buffer = buffer_pools_[worker_id]->Acquire();
+    }
+
+    void HttpServer::ReleaseBuffer(int worker_id, Event *event) {
+        buffer_pools_[worker_id]->Release(event->buffer);
+        event->buffer = nullptr;
+        event->length = event->cursor = 0;
+    }
+
+    void HttpServer::DeleteEvent(int worker_id, Event *event) {
+        ReleaseBuffer(worker_id, event);
+        delete event;
+    }
+
     void HttpServer::ControlEpollEvent(int epoll_fd, int op, int fd, std::uint32_t events, void *data) {
         if (op == EPOLL_CTL_DEL) {
             if (epoll_ctl(epoll_fd, op, fd, nullptr) < 0) {
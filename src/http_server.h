@@ -9,22 +9,67 @@
 #include <sys/types.h>
 #include <sys/socket.h>
 
+#include <chrono>
 #include <string>
 #include <functional>
 #include <thread>
 #include <map>
+#include <memory>
+#include <mutex>
+#include <utility>
+#include <vector>
 
+#include "access_log.h"
+#include "buffer_pool.h"
+#include "http2.h"
 #include "http_message.h"
+#include "http_proxy.h"
+#include "message_arena.h"
+#include "rate_limiter.h"
+#include "tracer.h"
+#include "websocket.h"
 
 namespace basic_http_server {
     constexpr size_t kMaxBufferSize = 4096;
 
+    struct ProxySession;
+
+    // State of one connection, about 64 bytes: the I/O buffer is borrowed from the worker BufferPool
+    // only while a request is read or a response written, and is null while the connection is idle
     struct Event {
-        Event() : fd(0), length(0), cursor(0), buffer() {}
+        Event() : fd(0), address(0), trace_id(0), length(0), cursor(0), proxy(nullptr), http2(nullptr),
+            websocket(nullptr), buffer(nullptr) {}
         int fd;
+        std::uint32_t address;  // peer IPv4 address, network byte order
+        std::uint32_t trace_id; // non zero while a sampled request is traced
         size_t length;
         size_t cursor;
-        char buffer[kMaxBufferSize];
+        ProxySession *proxy;    // set while the connection takes part in a proxied request
+        Http2Connection *http2; // set once the connection has switched to HTTP/2
+        WebSocketConnection *websocket; // set once the connection has switched to WebSocket
+        char *buffer;           // kMaxBufferSize bytes when set
+    };
+    static_assert(sizeof(Event) <= 128, "every connection holds an Event, even while idle");
+
+    // A request relayed from a client connection to an upstream connection.
+    // The client event buffer carries request bytes, the upstream event buffer response bytes.
+    struct ProxySession {
+        ProxySession() : client(nullptr), upstream(nullptr), route(nullptr), server(nullptr), attempts(1),
+            request(HttpFramer::Kind::Request), response(HttpFramer::Kind::Response),
+            connected(false), response_started(false), index(0), start(std::chrono::steady_clock::now()),
+            deadline() {}
+        Event *client;
+        Event *upstream;
+        ProxyRoute *route;
+        Upstream *server;
+        int attempts;
+        HttpFramer request;
+        HttpFramer response;
+        bool connected;
+        bool response_started;
+        size_t index;           // position in the active sessions of the worker
+        std::chrono::steady_clock::time_point start;
+        std::chrono::steady_clock::time_point deadline;     // aborted when no byte moves until then
     };
 
     // Request handle have a HTTP request as input and return a HTTP response
@@ -52,17 +97,67 @@ namespace basic_http_server {
         void Stop();
         void RegisterHttpRequestHandler(const std::string& path, HttpMethod method, const HttpRequestHandler_t callback);
         void RegisterHttpRequestHandler(const Uri uri, HttpMethod method, const HttpRequestHandler_t callback);
+        /**
+         * Match request paths to routes regardless of case, off by default, must be called before Start.
+         * Throws std::invalid_argument, and changes nothing, when two registered routes differ only in case.
+         */
+        void SetCaseInsensitiveRouting(bool enabled);
+        /**
+         * Limit the request rate of every peer IP address with a token bucket.
+         * The route overload adds a separate per peer limit on a single path, or on every path of a proxy route
+         * when path is its prefix.
+         * Rejected requests get a 429 Too Many Requests response.
+         */
+        void SetRateLimit(double requests_per_second, double burst);
+        void SetRateLimit(const std::string& path, double requests_per_second, double burst);
+        /**
+         * Forward every request whose path starts with path_prefix to one of the upstream servers.
+         * Upstream connections are non-blocking, kept alive and pooled by each worker thread.
+         */
+        void RegisterProxyHandler(const std::string& path_prefix, const std::vector<UpstreamAddress>& upstreams,
+                                  LoadBalancing balancing = LoadBalancing::RoundRobin);
+        // Abort a proxied request when neither side makes progress for timeout, 30 seconds by default
+        void SetProxyTimeout(std::chrono::milliseconds timeout) { proxy_timeout_ = timeout; }
+        /**
+         * Accept WebSocket upgrade requests on path.
+         * Broadcast sends a message to every connection of the path, on all worker threads:
+         * the frame is serialized once and shared, clients which do not keep up are disconnected.
+         */
+        void RegisterWebSocketHandler(const std::string& path, const WebSocketHandler& handler);
+        void Broadcast(const std::string& path, const std::string& message, bool binary = false);
+        /**
+         * Append an access log line for every HTTP request to the file at path, must be called before Start.
+         * Workers queue fixed-size records without blocking; records are dropped when the log falls behind.
+         */
+        void EnableAccessLog(const std::string& path);
+        std::uint64_t access_log_dropped() const { return access_log_ ? access_log_->dropped() : 0; }
+        /**
+         * Record the stages of one in every one_in requests (0 disables it), exported as Chrome trace JSON.
+         * Only available when built with the BASIC_HTTP_SERVER_TRACING option, see Tracer.
+         */
+        void SetTraceSampling(std::uint32_t one_in) { tracer_->SetSampling(one_in); }
+        std::string ExportTrace() const { return tracer_->Export(); }
 
         std::string host() const { return host_; }
         std::uint16_t port() const { return port_; }
         bool running() const { return running_; }
     private:
+        // Frames broadcast to the connections of a worker, filled by any thread
+        struct BroadcastQueue {
+            std::mutex mutex;
+            std::vector<std::pair<const WebSocketHandler*, WebSocketFrame_t>> frames;
+        };
 
     private:
         static constexpr int kBacklogSize = 1000;
         static constexpr int kMaxConnections = 10000;
         static constexpr int kMaxEvents = 10000;
         static constexpr int kThreadPoolSize = 10;
+        static constexpr size_t kMaxIdleUpstreamConnections = 64;   // per upstream and worker
+        static constexpr int kMaxProxyAttempts = 3;
+        static constexpr std::chrono::milliseconds kProxyCheckInterval{100};
+        static constexpr size_t kMaxWebSocketIov = 64;     // frames written by one sendmsg call
+        static constexpr size_t kMaxFreeBuffers = 256;     // I/O buffers kept for reuse by each worker
 
         std::string host_;
         std::uint16_t port_;
@@ -72,16 +167,75 @@ namespace basic_http_server {
         std::thread workers_[kThreadPoolSize];
         int worker_epoll_fd_[kThreadPoolSize];
         epoll_event worker_events_[kThreadPoolSize][kMaxEvents];
-        std::map<Uri, std::map<HttpMethod, HttpRequestHandler_t>> request_handlers_;
+        std::map<Uri, std::map<HttpMethod, HttpRequestHandler_t>, UriLess> request_handlers_;
+        std::unique_ptr<RateLimiter> rate_limiter_;
+        std::map<Uri, std::unique_ptr<RateLimiter>, UriLess> route_rate_limiters_;
+        std::string too_many_requests_;     // pre-serialized 429 response
+        std::vector<std::unique_ptr<ProxyRoute>> proxy_routes_;
+        std::map<const Upstream*, std::vector<int>> upstream_connections_[kThreadPoolSize];
+        std::vector<ProxySession*> proxy_sessions_[kThreadPoolSize];
+        std::chrono::milliseconds proxy_timeout_{30000};
+        std::chrono::steady_clock::time_point proxy_check_at_[kThreadPoolSize];  // next look for expired sessions
+        std::vector<Event*> retired_events_[kThreadPoolSize];
+        std::map<Uri, WebSocketHandler, UriLess> websocket_handlers_;
+        std::map<const WebSocketHandler*, std::vector<Event*>> websocket_subscribers_[kThreadPoolSize];
+        std::unique_ptr<BroadcastQueue> broadcast_queues_[kThreadPoolSize];
+        Event wakeup_events_[kThreadPoolSize];     // eventfd signalled when broadcast frames are queued
+        std::unique_ptr<MessageArena> message_arenas_[kThreadPoolSize];    // backs the request being handled
+        std::unique_ptr<BufferPool> buffer_pools_[kThreadPoolSize];
+        std::unique_ptr<AccessLog> access_log_;
+        std::unique_ptr<Tracer> tracer_;
 
         void InitSocket();
         void InitEpoll();
+        void InitTooManyRequests();
         void Listen();
         void ProcessEvent(int worker_id);
-        void HandleEpollEvent(int epoll_fd, Event *event, std::uint32_t events);
-        void HandleHttpData(const Event& request_event, Event* response_event);
+        void HandleEpollEvent(int worker_id, Event *event, std::uint32_t events);
+        void HandleHttpData(int worker_id, Event* event);
+        void RejectHttpRequest(int worker_id, Event* event);
+        // Answer the request in the buffer of event with an error response, sent before the next request is read
+        void ReplyHttp(int worker_id, Event *event, HttpResponse response);
         HttpResponse HandleHttpRequest(const HttpRequest& request);
 
+        bool StartHttp2(int worker_id, Event *event);
+        void HandleHttp2Event(int worker_id, Event *event, std::uint32_t events);
+        void FlushHttp2(int worker_id, Event *event);
+        void CloseHttp2(int worker_id, Event *event);
+        HttpResponse HandleHttp2Request(int worker_id, const HttpRequest& request, std::uint32_t address);
+        void LogAccess(int worker_id, std::uint32_t address, const HttpRequest& request, const HttpResponse& response,
+                       std::chrono::steady_clock::time_point start);
+        // Request known by its raw start line only, not logged if it cannot be parsed
+        void LogAccess(int worker_id, std::uint32_t address, std::string_view start_line, int status_code,
+                       std::uint64_t bytes, std::chrono::steady_clock::time_point start);
+        void LogAccess(int worker_id, std::uint32_t address, HttpMethod method, HttpVersion version,
+                       std::string_view target, int status_code, std::uint64_t bytes,
+                       std::chrono::steady_clock::time_point start);
+
+        bool StartWebSocket(int worker_id, Event *event);
+        void HandleWebSocketEvent(int worker_id, Event *event, std::uint32_t events);
+        void FlushWebSocket(int worker_id, Event *event);
+        void CloseWebSocket(int worker_id, Event *event);
+        void DrainBroadcasts(int worker_id);
+
+        ProxyRoute* MatchProxyRoute(std::string_view path) const;
+        bool AllowProxyRequest(const ProxyRoute *route, std::string_view path, std::uint32_t address);
+        void StartProxy(int worker_id, Event *client, ProxyRoute *route);
+        void ExpireProxySessions(int worker_id);
+        void EndProxySession(int worker_id, ProxySession *session);
+        void HandleProxyEvent(int worker_id, Event *event, std::uint32_t events);
+        void RetryProxy(int worker_id, ProxySession *session);
+        void FinishProxy(int worker_id, ProxySession *session);
+        void AbortProxy(int worker_id, ProxySession *session, bool upstream_failed);
+        void ReplyProxyError(int worker_id, ProxySession *session, HttpStatusCode status_code);
+        int ConnectUpstream(int worker_id, ProxySession *session);
+        int AcquireUpstreamConnection(int worker_id, const Upstream *upstream, bool *connected);
+        void ReleaseUpstreamConnection(int worker_id, const Upstream *upstream, int fd);
+        void RetireEvent(int worker_id, Event *event);
+        void AcquireBuffer(int worker_id, Event *event);
+        void ReleaseBuffer(int worker_id, Event *event);
+        void DeleteEvent(int worker_id, Event *event);
+
         void ControlEpollEvent(int epoll_fd, int op, int fd, std::uint32_t events = 0, void *data = nullptr);
     };
 }
@@ -1,4 +1,6 @@
+#include <fstream>
 #include <iostream>
+#include <utility>
 
 #include "http_server.h"
 
@@ -15,7 +17,7 @@ int main(void) {
         response.SetHeader("Content-Type", "text/html");
         std::string content;
 
-        response.SetContent(content);
+        response.SetContent(std::move(content));
         return response;
     };
     auto send_html = [](const HttpRequest& request) -> HttpResponse {
@@ -28,7 +30,7 @@ int main(void) {
         content += "</body>\n</html>\n";
 
         response.SetHeader("Content-Type", "text/html");
-        response.SetContent(content);
+        response.SetContent(std::move(content));
         return response;
     };
 
@@ -36,15 +38,23 @@ int main(void) {
     server.RegisterHttpRequestHandler("/", HttpMethod::GET, say_hello);
     server.RegisterHttpRequestHandler("/hello.html", HttpMethod::HEAD, send_html);
     server.RegisterHttpRequestHandler("/hello.html", HttpMethod::GET, send_html);
+    server.SetTraceSampling(100);
 
     try {
         std::cout << "Starting the web server.." << std::endl;
         server.Start();
         std::cout << "Server listening on " << host << ":" << port << std::endl;
 
-        std::cout << "Enter [quit] to stop the server" << std::endl;
+        std::cout << "Enter [quit] to stop the server";
+        if (Tracer::kEnabled) std::cout << ", [trace] to write sampled request traces to trace.json";
+        std::cout << std::endl;
         std::string command;
-        while (std::cin >> command, command != "quit");
+        while (std::cin >> command, command != "quit") {
+            if (command == "trace" && Tracer::kEnabled) {
+                std::ofstream("trace.json") << server.ExportTrace();
+                std::cout << "Trace written to trace.json, open it in ui.perfetto.dev" << std::endl;
+            }
+        }
         std::cout << "'quit' command entered. Stopping the web server.." << std::endl;
         server.Stop();
         std::cout << "Server stopped" << std::endl;
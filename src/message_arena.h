@@ -0,0 +1,45 @@
+#ifndef BASIC_HTTP_SERVER_MESSAGE_ARENA_H
+#define BASIC_HTTP_SERVER_MESSAGE_ARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+
+namespace basic_http_server {
+
+    /**
+     * Monotonic arena backing the headers and URI of the request being handled by a worker thread.
+     * Allocation is a pointer bump into a preallocated block; nothing is freed until the
+     * scope ends, then the whole arena is released at once and the block reused by the next request.
+     * Only objects explicitly given resource() live in the arena and they must not outlive the scope;
+     * copies of them use the default resource again.
+     */
+    class MessageArena {
+    public:
+        static constexpr size_t kInitialSize = 16 * 1024;
+
+        MessageArena() : resource_(buffer_, kInitialSize) {}
+        MessageArena(const MessageArena&) = delete;
+        MessageArena& operator=(const MessageArena&) = delete;
+
+        std::pmr::memory_resource* resource() { return &resource_; }
+
+        // Releases everything allocated from the arena when the scope ends
+        class Scope {
+        public:
+            explicit Scope(MessageArena& arena) : arena_(arena) {}
+            ~Scope() { arena_.resource_.release(); }
+            Scope(const Scope&) = delete;
+            Scope& operator=(const Scope&) = delete;
+
+        private:
+            MessageArena& arena_;
+        };
+
+    private:
+        alignas(std::max_align_t) char buffer_[kInitialSize];
+        std::pmr::monotonic_buffer_resource resource_;
+    };
+
+}
+
+#endif //BASIC_HTTP_SERVER_MESSAGE_ARENA_H
@@ -0,0 +1,57 @@
+#include "rate_limiter.h"
+
+#include <algorithm>
+#include <iterator>
+
+namespace basic_http_server {
+
+    RateLimiter::RateLimiter(RateLimit limit, size_t capacity) :
+        limit_(limit), shard_capacity_(std::max<size_t>(1, capacity / kShardCount)) {
+        for (auto& shard : shards_) {
+            shard.index.reserve(shard_capacity_);
+        }
+    }
+
+    bool RateLimiter::Allow(std::uint64_t key, Clock::time_point now) {
+        Shard& shard = shards_[ShardOf(key)];
+        std::lock_guard<std::mutex> lock(shard.mutex);
+
+        auto it = shard.index.find(key);
+        if (it == shard.index.end()) {
+            if (shard.buckets.size() < shard_capacity_) {
+                shard.buckets.emplace_front();
+            } else {                        // recycle the least recently used bucket
+                shard.index.erase(shard.buckets.back().key);
+                shard.buckets.splice(shard.buckets.begin(), shard.buckets, std::prev(shard.buckets.end()));
+            }
+            Bucket& bucket = shard.buckets.front();
+            bucket.key = key;
+            bucket.tokens = limit_.burst;
+            bucket.last_refill = now;
+            it = shard.index.emplace(key, shard.buckets.begin()).first;
+        } else if (it->second != shard.buckets.begin()) {
+            shard.buckets.splice(shard.buckets.begin(), shard.buckets, it->second);
+        }
+
+        Bucket& bucket = *it->second;
+        if (now > bucket.last_refill) {
+            std::chrono::duration<double> elapsed = now - bucket.last_refill;
+            bucket.tokens = std::min(limit_.burst, bucket.tokens + elapsed.count() * limit_.rate);
+            bucket.last_refill = now;
+        }
+        if (bucket.tokens < 1.0) {
+            return false;
+        }
+        bucket.tokens -= 1.0;
+        return true;
+    }
+
+    size_t RateLimiter::ShardOf(std::uint64_t key) {
+        // mix the bits so that neighbouring addresses land on different shards
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return key % kShardCount;
+    }
+
+}
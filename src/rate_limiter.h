@@ -0,0 +1,68 @@
+#ifndef BASIC_HTTP_SERVER_RATE_LIMITER_H
+#define BASIC_HTTP_SERVER_RATE_LIMITER_H
+
+#include <chrono>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+
+namespace basic_http_server {
+
+    // Token bucket parameters: refill rate (tokens per second) and bucket capacity
+    struct RateLimit {
+        double rate;
+        double burst;
+    };
+
+    /**
+     * Table of token buckets indexed by a 64 bit key (for example: the peer IPv4 address)
+     * Keys are spread over independently locked shards so worker threads rarely contend.
+     * Memory is bounded: every shard holds a fixed number of buckets and evicts the least
+     * recently used (idle) bucket when it is full. An evicted bucket would have been
+     * refilled to its burst size anyway, so eviction never makes a limit stricter.
+     */
+    class RateLimiter {
+    public:
+        using Clock = std::chrono::steady_clock;
+
+        static constexpr size_t kShardCount = 64;
+        static constexpr size_t kDefaultCapacity = 65536;
+
+        explicit RateLimiter(RateLimit limit, size_t capacity = kDefaultCapacity);
+        ~RateLimiter() = default;
+
+        RateLimiter(const RateLimiter&) = delete;
+        RateLimiter& operator=(const RateLimiter&) = delete;
+
+        // Take one token from the bucket of key, return false if the bucket is empty
+        bool Allow(std::uint64_t key) { return Allow(key, Clock::now()); }
+        bool Allow(std::uint64_t key, Clock::time_point now);
+
+        RateLimit limit() const { return limit_; }
+        size_t capacity() const { return shard_capacity_ * kShardCount; }
+
+    private:
+        struct Bucket {
+            std::uint64_t key;
+            double tokens;
+            Clock::time_point last_refill;
+        };
+
+        // Aligned to a cache line so that locking a shard never invalidates its neighbours
+        struct alignas(64) Shard {
+            std::mutex mutex;
+            std::list<Bucket> buckets;      // most recently used first
+            std::unordered_map<std::uint64_t, std::list<Bucket>::iterator> index;
+        };
+
+        RateLimit limit_;
+        size_t shard_capacity_;
+        Shard shards_[kShardCount];
+
+        static size_t ShardOf(std::uint64_t key);
+    };
+
+}
+
+#endif //BASIC_HTTP_SERVER_RATE_LIMITER_H
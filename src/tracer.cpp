@@ -0,0 +1,97 @@
+#include "tracer.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <limits>
+
+namespace basic_http_server {
+
+    Tracer::Tracer(size_t worker_count) :
+        worker_count_(worker_count), workers_(new WorkerTrace[worker_count]), sampling_(0), next_id_(0) {}
+
+    std::uint32_t Tracer::Sample(size_t worker) {
+        std::uint32_t one_in = sampling_.load(std::memory_order_relaxed);
+        if (one_in == 0 || ++workers_[worker].requests % one_in != 0) return 0;
+        std::uint32_t id = next_id_.fetch_add(1, std::memory_order_relaxed) + 1;
+        return id != 0 ? id : 1;
+    }
+
+    void Tracer::BeginIteration(size_t worker, int event_count) {
+        std::uint32_t one_in = sampling_.load(std::memory_order_relaxed);
+        WorkerTrace& trace = workers_[worker];
+        // idle iterations of the busy polling loop are not recorded
+        if (one_in == 0 || event_count <= 0) {
+            trace.iteration_start = 0;
+            return;
+        }
+        trace.iteration_start = Now();
+        trace.iteration_sampled = ++trace.iterations % one_in == 0;
+    }
+
+    void Tracer::EndIteration(size_t worker) {
+        WorkerTrace& trace = workers_[worker];
+        if (trace.iteration_start != 0 && trace.iteration_sampled) {
+            Record(worker, "loop", 0, trace.iteration_start);
+        }
+    }
+
+    void Tracer::RecordDispatch(size_t worker, std::uint32_t id) {
+        std::uint64_t start = workers_[worker].iteration_start;
+        if (start != 0) Record(worker, "dispatch", id, start);
+    }
+
+    void Tracer::Record(size_t worker, const char *name, std::uint32_t id, std::uint64_t start) {
+        std::uint64_t duration = Now() - start;
+        TraceEvent event{name, start, static_cast<std::uint32_t>(
+            std::min<std::uint64_t>(duration, std::numeric_limits<std::uint32_t>::max())), id};
+        WorkerTrace& trace = workers_[worker];
+
+        // only sampled events get here, the lock is uncontended unless an export is running
+        std::lock_guard<std::mutex> lock(trace.mutex);
+        if (trace.events.size() < kMaxEventsPerWorker) {
+            trace.events.push_back(event);
+        } else {
+            trace.events[trace.next] = event;
+            trace.next = (trace.next + 1) % kMaxEventsPerWorker;
+        }
+    }
+
+    std::string Tracer::Export() const {
+        std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+        char line[256];
+        bool first = true;
+        auto append = [&](int length) {
+            if (!first) json.push_back(',');
+            json.append(line, std::min<size_t>(length, sizeof(line) - 1));
+            first = false;
+        };
+
+        for (size_t worker = 0; worker < worker_count_; worker++) {
+            append(snprintf(line, sizeof(line),
+                            "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":\"worker %zu\"}}",
+                            worker, worker));
+
+            std::vector<TraceEvent> events;
+            {
+                std::lock_guard<std::mutex> lock(workers_[worker].mutex);
+                events = workers_[worker].events;
+            }
+            for (const TraceEvent& event : events) {
+                // timestamps are in microseconds
+                int length = snprintf(line, sizeof(line),
+                                      "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":1,\"tid\":%zu",
+                                      event.name, event.id != 0 ? "request" : "worker", event.start / 1000.0,
+                                      event.duration / 1000.0, worker);
+                if (event.id != 0) {
+                    length += snprintf(line + length, sizeof(line) - length, ",\"args\":{\"request\":%u}}", event.id);
+                } else {
+                    length += snprintf(line + length, sizeof(line) - length, "}");
+                }
+                append(length);
+            }
+        }
+        json.append("]}\n");
+        return json;
+    }
+
+}
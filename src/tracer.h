@@ -0,0 +1,98 @@
+#ifndef BASIC_HTTP_SERVER_TRACER_H
+#define BASIC_HTTP_SERVER_TRACER_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace basic_http_server {
+
+    /**
+     * Records how long the stages of sampled requests and the iterations of the worker loops take,
+     * and exports them in the Chrome trace event format (chrome://tracing, ui.perfetto.dev).
+     * Probes are the TRACE_* macros below, they compile to nothing unless BASIC_HTTP_SERVER_TRACING is defined.
+     */
+    class Tracer {
+    public:
+#ifdef BASIC_HTTP_SERVER_TRACING
+        static constexpr bool kEnabled = true;
+#else
+        static constexpr bool kEnabled = false;
+#endif
+        static constexpr size_t kMaxEventsPerWorker = 1 << 16;     // older events are overwritten
+
+        explicit Tracer(size_t worker_count);
+        Tracer(const Tracer&) = delete;
+        Tracer& operator=(const Tracer&) = delete;
+
+        // Trace one in every one_in requests and worker loop iterations, 0 disables tracing
+        void SetSampling(std::uint32_t one_in) { sampling_.store(one_in, std::memory_order_relaxed); }
+
+        // Monotonic clock (clock_gettime through the vDSO), in nanoseconds
+        static std::uint64_t Now() {
+            return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count();
+        }
+
+        // Id of a new request if it is sampled, 0 otherwise
+        std::uint32_t Sample(size_t worker);
+        // Called after epoll_wait returns event_count events, and once they are processed
+        void BeginIteration(size_t worker, int event_count);
+        void EndIteration(size_t worker);
+        // Time between epoll_wait returning and the event of request id being dispatched
+        void RecordDispatch(size_t worker, std::uint32_t id);
+        void Record(size_t worker, const char *name, std::uint32_t id, std::uint64_t start);
+
+        // Chrome trace JSON of the recorded events
+        std::string Export() const;
+
+    private:
+        struct TraceEvent {
+            const char *name;           // string literal
+            std::uint64_t start;
+            std::uint32_t duration;
+            std::uint32_t id;           // request, 0 for loop iterations
+        };
+
+        // Written by one worker thread, read on export
+        struct alignas(64) WorkerTrace {
+            std::uint64_t requests = 0;
+            std::uint64_t iterations = 0;
+            std::uint64_t iteration_start = 0;
+            bool iteration_sampled = false;
+            mutable std::mutex mutex;
+            std::vector<TraceEvent> events;
+            size_t next = 0;            // oldest event once the buffer is full
+        };
+
+        size_t worker_count_;
+        std::unique_ptr<WorkerTrace[]> workers_;
+        std::atomic<std::uint32_t> sampling_;
+        std::atomic<std::uint32_t> next_id_;
+    };
+
+}
+
+#ifdef BASIC_HTTP_SERVER_TRACING
+#define TRACE_SAMPLE(tracer, worker) ((tracer).Sample(worker))
+#define TRACE_BEGIN(start, id) std::uint64_t start = (id) != 0 ? ::basic_http_server::Tracer::Now() : 0
+#define TRACE_END(tracer, worker, name, id, start) \
+    do { if ((id) != 0) (tracer).Record(worker, name, id, start); } while (0)
+#define TRACE_DISPATCH(tracer, worker, id) \
+    do { if ((id) != 0) (tracer).RecordDispatch(worker, id); } while (0)
+#define TRACE_ITERATION_BEGIN(tracer, worker, event_count) (tracer).BeginIteration(worker, event_count)
+#define TRACE_ITERATION_END(tracer, worker) (tracer).EndIteration(worker)
+#else
+#define TRACE_SAMPLE(tracer, worker) 0u
+#define TRACE_BEGIN(start, id) ((void)0)
+#define TRACE_END(tracer, worker, name, id, start) ((void)0)
+#define TRACE_DISPATCH(tracer, worker, id) ((void)0)
+#define TRACE_ITERATION_BEGIN(tracer, worker, event_count) ((void)0)
+#define TRACE_ITERATION_END(tracer, worker) ((void)0)
+#endif
+
+#endif //BASIC_HTTP_SERVER_TRACER_H
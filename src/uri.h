@@ -5,45 +5,167 @@
 #ifndef BASIC_HTTP_SERVER_URI_H
 #define BASIC_HTTP_SERVER_URI_H
 
+#include <strings.h>
+
 #include <algorithm>
 #include <cctype>
+#include <cstdint>
+#include <map>
+#include <memory_resource>
+#include <optional>
 #include <string>
+#include <string_view>
 #include <utility>
 
+
 namespace basic_http_server {
 
-    // A Uri object will contain a valid scheme (for example: HTTP), host,
-    // port, and the actual URI path
+    // Decode %XX escapes, and '+' as a space in query components
+    // Invalid escapes are kept as they are
+    inline std::string percent_decode(std::string_view input, bool plus_as_space = false) {
+        auto hex = [](char c) -> int {
+            if (c >= '0' && c <= '9') return c - '0';
+            if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+            if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+            return -1;
+        };
+        std::string result;
+        result.reserve(input.length());
+        for (size_t i = 0; i < input.length(); i++) {
+            int high, low;
+            if (input[i] == '%' && i + 2 < input.length() && (high = hex(input[i + 1])) >= 0 &&
+                (low = hex(input[i + 2])) >= 0) {
+                result.push_back(static_cast<char>(high * 16 + low));
+                i += 2;
+            } else if (input[i] == '+' && plus_as_space) {
+                result.push_back(' ');
+            } else {
+                result.push_back(input[i]);
+            }
+        }
+        return result;
+    }
+
+    // A Uri object holds the request target (for example: /index.html?lang=en) as it was received.
+    // The target is split once into its components, which are returned as views into it;
+    // percent-decoding and query parameters are only computed when asked for.
     class Uri {
     public:
-        Uri() = default;
-        explicit Uri(const std::string& path) : path_(path) {
-            SetPathToLowercase();
+        Uri() : path_offset_(0), path_length_(0) {}
+        // The target is stored in resource, see MessageArena
+        explicit Uri(std::pmr::memory_resource *resource) : target_(resource), path_offset_(0), path_length_(0) {}
+        explicit Uri(std::string_view target, std::pmr::memory_resource *resource = std::pmr::get_default_resource()) :
+            target_(target, resource) {
+            Split();
         }
         ~Uri() = default;
 
-        inline bool operator<(const Uri& other) const { return path_ < other.path_; }
-        inline bool operator==(const Uri& other) const { return path_ == other.path_; }
+        // Routes compare the path only, so /a?x=1 matches /a
+        inline bool operator<(const Uri& other) const { return path() < other.path(); }
+        inline bool operator==(const Uri& other) const { return path() == other.path(); }
+
+        void SetPath(std::string_view target) {
+            target_.assign(target.data(), target.length());
+            Split();
+        }
 
-        void SetPath(const std::string& path) {
-            path_ = std::move(path);
-            SetPathToLowercase();
+        std::string_view target() const { return target_; }
+        // Set for absolute-form targets (http://host:port/path) only
+        std::string_view scheme() const {
+            return std::string_view(target_).substr(0, path_offset_ > 0 ? target_.find("://") : 0);
+        }
+        std::string_view host() const { return authority().substr(0, port_separator()); }
+        std::uint16_t port() const {
+            std::uint16_t port = 0;
+            size_t colon = port_separator();
+            if (colon == std::string_view::npos) return port;
+            for (char c : authority().substr(colon + 1)) {
+                if (!std::isdigit(static_cast<unsigned char>(c))) return 0;
+                port = port * 10 + (c - '0');
+            }
+            return port;
+        }
+        std::string_view path() const { return std::string_view(target_).substr(path_offset_, path_length_); }
+        std::string_view query() const {
+            size_t begin = path_offset_ + path_length_;
+            if (begin == target_.length() || target_[begin] != '?') return std::string_view();
+            return std::string_view(target_).substr(begin + 1, target_.find('#', begin) - begin - 1);
         }
+        std::string decoded_path() const { return percent_decode(path()); }
 
-        std::string scheme() const { return scheme_; }
-        std::string host() const { return host_; }
-        std::uint16_t port() const { return port_; }
-        std::string path() const { return path_; }
+        // Decoded value of the first query parameter called name
+        std::optional<std::string> query_param(std::string_view name) const {
+            std::optional<std::string> value;
+            ForEachQueryParam([&](std::string_view key, std::string_view raw_value) {
+                if (key.find_first_of("%+") == std::string_view::npos ? key == name : percent_decode(key, true) == name) {
+                    value = percent_decode(raw_value, true);
+                    return false;
+                }
+                return true;
+            });
+            return value;
+        }
+        std::map<std::string, std::string> query_params() const {
+            std::map<std::string, std::string> params;
+            ForEachQueryParam([&](std::string_view key, std::string_view raw_value) {
+                params.emplace(percent_decode(key, true), percent_decode(raw_value, true));
+                return true;
+            });
+            return params;
+        }
 
     private:
-        // Only the path is supported for now
-        std::string path_;
-        std::string scheme_;
-        std::string host_;
-        std::uint16_t port_;
-
-        void SetPathToLowercase() {
-            std::transform(path_.begin(), path_.end(), path_.begin(), [](char c) { return tolower(c); });
+        std::pmr::string target_;
+        size_t path_offset_;        // non zero for absolute-form targets
+        size_t path_length_;
+
+        void Split() {
+            path_offset_ = 0;
+            size_t scheme_end = target_.find("://");
+            if (!target_.empty() && target_[0] != '/' && scheme_end != std::string::npos) {
+                path_offset_ = std::min(target_.find('/', scheme_end + 3), target_.length());
+            }
+            path_length_ = std::min(target_.find_first_of("?#", path_offset_), target_.length()) - path_offset_;
+        }
+
+        std::string_view authority() const {
+            if (path_offset_ == 0) return std::string_view();
+            size_t begin = target_.find("://") + 3;
+            return std::string_view(target_).substr(begin, path_offset_ - begin);
+        }
+        size_t port_separator() const {
+            std::string_view a = authority();
+            size_t colon = a.rfind(':');
+            return colon != std::string_view::npos && a.find(']', colon) == std::string_view::npos ? colon
+                                                                                                    : std::string_view::npos;
+        }
+
+        // Call f(key, value) on every raw key=value pair of the query until it returns false
+        template <typename F>
+        void ForEachQueryParam(F f) const {
+            std::string_view rest = query();
+            while (!rest.empty()) {
+                size_t end = std::min(rest.find('&'), rest.length());
+                std::string_view pair = rest.substr(0, end);
+                rest.remove_prefix(std::min(end + 1, rest.length()));
+                if (pair.empty()) continue;
+                size_t equal = pair.find('=');
+                std::string_view key = pair.substr(0, equal);
+                std::string_view value = equal == std::string_view::npos ? std::string_view() : pair.substr(equal + 1);
+                if (!f(key, value)) return;
+            }
+        }
+    };
+
+    // Routing policy: paths are case sensitive unless case folding is enabled
+    struct UriLess {
+        bool ignore_case = false;
+
+        bool operator()(const Uri& lhs, const Uri& rhs) const {
+            if (!ignore_case) return lhs < rhs;
+            std::string_view a = lhs.path(), b = rhs.path();
+            int result = strncasecmp(a.data(), b.data(), std::min(a.length(), b.length()));
+            return result != 0 ? result < 0 : a.length() < b.length();
         }
     };
 
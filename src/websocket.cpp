@@ -0,0 +1,291 @@
+#include "websocket.h"
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include <cstring>
+#include <string>
+#include <utility>
+
+namespace basic_http_server {
+
+    namespace {
+        constexpr char kWebSocketGuid[] = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+        std::uint32_t rotate_left(std::uint32_t value, int bits) {
+            return (value << bits) | (value >> (32 - bits));
+        }
+
+        // SHA-1 digest https://www.rfc-editor.org/rfc/rfc3174, only used for the handshake
+        std::string sha1(const std::string& input) {
+            std::uint32_t h[5] = {0x67452301, 0xefcdab89, 0x98badcfe, 0x10325476, 0xc3d2e1f0};
+            std::string message = input;
+            std::uint64_t bit_length = static_cast<std::uint64_t>(input.length()) * 8;
+            message.push_back(static_cast<char>(0x80));
+            while (message.length() % 64 != 56) message.push_back(0);
+            for (int i = 7; i >= 0; i--) message.push_back(static_cast<char>(bit_length >> (i * 8)));
+
+            for (size_t chunk = 0; chunk < message.length(); chunk += 64) {
+                std::uint32_t w[80];
+                for (int i = 0; i < 16; i++) {
+                    const auto *p = reinterpret_cast<const std::uint8_t *>(message.data() + chunk + i * 4);
+                    w[i] = (static_cast<std::uint32_t>(p[0]) << 24) | (p[1] << 16) | (p[2] << 8) | p[3];
+                }
+                for (int i = 16; i < 80; i++) w[i] = rotate_left(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+
+                std::uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+                for (int i = 0; i < 80; i++) {
+                    std::uint32_t f, k;
+                    if (i < 20) {
+                        f = (b & c) | (~b & d);
+                        k = 0x5a827999;
+                    } else if (i < 40) {
+                        f = b ^ c ^ d;
+                        k = 0x6ed9eba1;
+                    } else if (i < 60) {
+                        f = (b & c) | (b & d) | (c & d);
+                        k = 0x8f1bbcdc;
+                    } else {
+                        f = b ^ c ^ d;
+                        k = 0xca62c1d6;
+                    }
+                    std::uint32_t temp = rotate_left(a, 5) + f + e + k + w[i];
+                    e = d;
+                    d = c;
+                    c = rotate_left(b, 30);
+                    b = a;
+                    a = temp;
+                }
+                h[0] += a;
+                h[1] += b;
+                h[2] += c;
+                h[3] += d;
+                h[4] += e;
+            }
+
+            std::string digest;
+            for (std::uint32_t word : h) {
+                for (int i = 3; i >= 0; i--) digest.push_back(static_cast<char>(word >> (i * 8)));
+            }
+            return digest;
+        }
+
+        std::string base64_encode(const std::string& input) {
+            static const char kAlphabet[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+            std::string result;
+            size_t i = 0;
+            for (; i + 2 < input.length(); i += 3) {
+                std::uint32_t bits = (static_cast<std::uint8_t>(input[i]) << 16) |
+                                     (static_cast<std::uint8_t>(input[i + 1]) << 8) | static_cast<std::uint8_t>(input[i + 2]);
+                result.push_back(kAlphabet[(bits >> 18) & 0x3f]);
+                result.push_back(kAlphabet[(bits >> 12) & 0x3f]);
+                result.push_back(kAlphabet[(bits >> 6) & 0x3f]);
+                result.push_back(kAlphabet[bits & 0x3f]);
+            }
+            if (i < input.length()) {
+                std::uint32_t bits = static_cast<std::uint8_t>(input[i]) << 16;
+                if (i + 1 < input.length()) bits |= static_cast<std::uint8_t>(input[i + 1]) << 8;
+                result.push_back(kAlphabet[(bits >> 18) & 0x3f]);
+                result.push_back(kAlphabet[(bits >> 12) & 0x3f]);
+                result.push_back(i + 1 < input.length() ? kAlphabet[(bits >> 6) & 0x3f] : '=');
+                result.push_back('=');
+            }
+            return result;
+        }
+    }
+
+    std::string websocket_accept_key(const std::string &key) {
+        return base64_encode(sha1(key + kWebSocketGuid));
+    }
+
+    WebSocketFrame_t websocket_frame(WebSocketOpcode opcode, const std::string &payload) {
+        std::string frame;
+        size_t length = payload.length();
+        frame.reserve(length + 10);
+        frame.push_back(static_cast<char>(0x80 | static_cast<std::uint8_t>(opcode)));   // FIN
+        if (length < 126) {
+            frame.push_back(static_cast<char>(length));
+        } else if (length <= 0xffff) {
+            frame.push_back(126);
+            frame.push_back(static_cast<char>(length >> 8));
+            frame.push_back(static_cast<char>(length));
+        } else {
+            frame.push_back(127);
+            for (int i = 7; i >= 0; i--) frame.push_back(static_cast<char>(static_cast<std::uint64_t>(length) >> (i * 8)));
+        }
+        frame.append(payload);
+        return std::make_shared<const std::string>(std::move(frame));
+    }
+
+    void websocket_mask(char *data, size_t length, const std::uint8_t key[4], size_t key_offset) {
+        std::uint8_t rotated[4];
+        for (int i = 0; i < 4; i++) rotated[i] = key[(key_offset + i) & 3];
+        std::uint32_t key32;
+        memcpy(&key32, rotated, 4);
+        size_t i = 0;
+
+        // 16, then 8 bytes at a time: every block is a multiple of 4 so the key stays in phase
+#ifdef __SSE2__
+        __m128i key128 = _mm_set1_epi32(static_cast<int>(key32));
+        for (; i + 16 <= length; i += 16) {
+            __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(data + i));
+            _mm_storeu_si128(reinterpret_cast<__m128i *>(data + i), _mm_xor_si128(block, key128));
+        }
+#endif
+        std::uint64_t key64 = (static_cast<std::uint64_t>(key32) << 32) | key32;
+        for (; i + 8 <= length; i += 8) {
+            std::uint64_t block;
+            memcpy(&block, data + i, 8);
+            block ^= key64;
+            memcpy(data + i, &block, 8);
+        }
+        for (; i < length; i++) {
+            data[i] ^= rotated[i & 3];
+        }
+    }
+
+    bool WebSocketConnection::Send(const std::string &message, bool binary) {
+        return Enqueue(websocket_frame(binary ? WebSocketOpcode::Binary : WebSocketOpcode::Text, message));
+    }
+
+    void WebSocketConnection::Close(std::uint16_t status_code) {
+        if (closing_) return;
+        std::string payload;
+        payload.push_back(static_cast<char>(status_code >> 8));
+        payload.push_back(static_cast<char>(status_code));
+        Enqueue(websocket_frame(WebSocketOpcode::Close, payload));
+        closing_ = true;
+    }
+
+    void WebSocketConnection::Feed(const char *data, size_t length) {
+        if (closing_) return;
+        input_.append(data, length);
+
+        size_t pos = 0;
+        while (!closing_) {
+            size_t available = input_.length() - pos;
+            if (available < 2) break;
+            const auto *header = reinterpret_cast<const std::uint8_t *>(input_.data() + pos);
+            bool fin = (header[0] & 0x80) != 0;
+            auto opcode = static_cast<WebSocketOpcode>(header[0] & 0x0f);
+            std::uint64_t payload_length = header[1] & 0x7f;
+            size_t header_length = 2;
+
+            if (payload_length == 126) {
+                if (available < 4) break;
+                payload_length = (header[2] << 8) | header[3];
+                header_length = 4;
+            } else if (payload_length == 127) {
+                if (available < 10) break;
+                payload_length = 0;
+                for (int i = 2; i < 10; i++) payload_length = (payload_length << 8) | header[i];
+                header_length = 10;
+            }
+            // no extension is negotiated and every client frame must be masked
+            if ((header[0] & 0x70) != 0 || (header[1] & 0x80) == 0) {
+                Close(1002);
+                break;
+            }
+            if (payload_length > kMaxMessageSize) {
+                Close(1009);
+                break;
+            }
+            if (available < header_length + 4 + payload_length) break;
+
+            std::uint8_t key[4];
+            memcpy(key, header + header_length, 4);
+            char *payload = &input_[pos + header_length + 4];
+            websocket_mask(payload, payload_length, key);
+            pos += header_length + 4 + payload_length;
+            HandleFrame(fin, opcode, payload, payload_length);
+        }
+        input_.erase(0, pos);
+    }
+
+    void WebSocketConnection::HandleFrame(bool fin, WebSocketOpcode opcode, const char *payload, size_t length) {
+        if (static_cast<std::uint8_t>(opcode) >= 0x8 && (!fin || length > 125)) {   // control frame
+            Close(1002);
+            return;
+        }
+
+        switch (opcode) {
+            case WebSocketOpcode::Text:
+            case WebSocketOpcode::Binary:
+                if (message_opcode_ != WebSocketOpcode::Continuation) {     // previous message unfinished
+                    Close(1002);
+                    return;
+                }
+                message_opcode_ = opcode;
+                message_.assign(payload, length);
+                break;
+            case WebSocketOpcode::Continuation:
+                if (message_opcode_ == WebSocketOpcode::Continuation) {
+                    Close(1002);
+                    return;
+                }
+                if (message_.length() + length > kMaxMessageSize) {
+                    Close(1009);
+                    return;
+                }
+                message_.append(payload, length);
+                break;
+            case WebSocketOpcode::Close:
+                // echo the status code of the client
+                Close(length >= 2 ? (static_cast<std::uint8_t>(payload[0]) << 8) | static_cast<std::uint8_t>(payload[1])
+                                  : 1000);
+                return;
+            case WebSocketOpcode::Ping:
+                Enqueue(websocket_frame(WebSocketOpcode::Pong, std::string(payload, length)));
+                return;
+            case WebSocketOpcode::Pong:
+                return;
+            default:
+                Close(1002);
+                return;
+        }
+
+        if (fin) {
+            bool binary = message_opcode_ == WebSocketOpcode::Binary;
+            message_opcode_ = WebSocketOpcode::Continuation;
+            if (handler_->on_message) handler_->on_message(*this, message_, binary);
+            message_.clear();
+        }
+    }
+
+    bool WebSocketConnection::Enqueue(WebSocketFrame_t frame) {
+        if (closing_) return false;
+        if (queue_.size() >= kMaxQueuedFrames || queued_bytes_ + frame->length() > kMaxQueuedBytes) {
+            overflow_ = true;
+            return false;
+        }
+        queued_bytes_ += frame->length();
+        queue_.push_back(std::move(frame));
+        return true;
+    }
+
+    size_t WebSocketConnection::PrepareOutput(iovec *iov, size_t max_count) const {
+        size_t count = 0;
+        for (auto it = queue_.begin(); it != queue_.end() && count < max_count; ++it, ++count) {
+            size_t offset = count == 0 ? output_offset_ : 0;
+            iov[count].iov_base = const_cast<char *>((*it)->data() + offset);
+            iov[count].iov_len = (*it)->length() - offset;
+        }
+        return count;
+    }
+
+    void WebSocketConnection::Consume(size_t length) {
+        while (length > 0 && !queue_.empty()) {
+            size_t remaining = queue_.front()->length() - output_offset_;
+            if (length < remaining) {
+                output_offset_ += length;
+                return;
+            }
+            length -= remaining;
+            queued_bytes_ -= queue_.front()->length();
+            queue_.pop_front();
+            output_offset_ = 0;
+        }
+    }
+
+}
@@ -0,0 +1,99 @@
+#ifndef BASIC_HTTP_SERVER_WEBSOCKET_H
+#define BASIC_HTTP_SERVER_WEBSOCKET_H
+
+#include <sys/uio.h>
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+
+namespace basic_http_server {
+
+    // https://www.rfc-editor.org/rfc/rfc6455#section-5.2
+    enum class WebSocketOpcode : std::uint8_t {
+        Continuation = 0x0,
+        Text = 0x1,
+        Binary = 0x2,
+        Close = 0x8,
+        Ping = 0x9,
+        Pong = 0xa
+    };
+
+    // A serialized frame, shared by every connection it is sent to
+    using WebSocketFrame_t = std::shared_ptr<const std::string>;
+
+    // Value of Sec-WebSocket-Accept for the Sec-WebSocket-Key of a handshake request
+    std::string websocket_accept_key(const std::string& key);
+    // Server to client frame, unmasked
+    WebSocketFrame_t websocket_frame(WebSocketOpcode opcode, const std::string& payload);
+    // XOR data with the masking key, starting at byte key_offset of the key
+    void websocket_mask(char *data, size_t length, const std::uint8_t key[4], size_t key_offset = 0);
+
+    class WebSocketConnection;
+
+    // Callbacks of a WebSocket route, called from the worker thread owning the connection
+    struct WebSocketHandler {
+        std::function<void(WebSocketConnection&)> on_open;
+        std::function<void(WebSocketConnection&, const std::string& message, bool binary)> on_message;
+        std::function<void(WebSocketConnection&)> on_close;
+    };
+
+    /**
+     * A connection upgraded to the WebSocket protocol
+     * Parse the frames received from the client and keep a bounded queue of frames to send.
+     * Queued frames are shared pointers, a broadcast frame is serialized once for all subscribers.
+     */
+    class WebSocketConnection {
+    public:
+        static constexpr size_t kMaxMessageSize = 1 << 20;
+        static constexpr size_t kMaxQueuedFrames = 1024;
+        static constexpr size_t kMaxQueuedBytes = 4 << 20;
+
+        explicit WebSocketConnection(const WebSocketHandler *handler) :
+            handler_(handler), message_opcode_(WebSocketOpcode::Continuation), queued_bytes_(0),
+            output_offset_(0), closing_(false), overflow_(false), waiting_writable_(false),
+            subscriber_index_(0) {}
+
+        // Send a message to the client, must be called from the worker thread owning the connection
+        bool Send(const std::string& message, bool binary = false);
+        // Start the closing handshake
+        void Close(std::uint16_t status_code = 1000);
+
+        void Feed(const char *data, size_t length);
+        // Queue a frame, return false if the client does not read fast enough
+        bool Enqueue(WebSocketFrame_t frame);
+
+        // Fill iov with queued bytes, return the number of entries used
+        size_t PrepareOutput(iovec *iov, size_t max_count) const;
+        void Consume(size_t length);
+        bool output_pending() const { return !queue_.empty(); }
+
+        const WebSocketHandler* handler() const { return handler_; }
+        bool closing() const { return closing_; }
+        bool overflow() const { return overflow_; }
+        bool waiting_writable() const { return waiting_writable_; }
+        void set_waiting_writable(bool waiting) { waiting_writable_ = waiting; }
+        size_t subscriber_index() const { return subscriber_index_; }
+        void set_subscriber_index(size_t index) { subscriber_index_ = index; }
+
+    private:
+        const WebSocketHandler *handler_;
+        std::string input_;
+        std::string message_;                   // fragments of the current message
+        WebSocketOpcode message_opcode_;
+        std::deque<WebSocketFrame_t> queue_;
+        size_t queued_bytes_;
+        size_t output_offset_;                  // bytes of the first queued frame already sent
+        bool closing_;
+        bool overflow_;
+        bool waiting_writable_;
+        size_t subscriber_index_;
+
+        void HandleFrame(bool fin, WebSocketOpcode opcode, const char *payload, size_t length);
+    };
+
+}
+
+#endif //BASIC_HTTP_SERVER_WEBSOCKET_H